@@ -38,11 +38,28 @@ contains(QT, systeminfo) {
 
 blackberry: LIBS += -lbbplatform -lbbdevice
 
+# Subsystems that can be left out of the build, by adding to CONFIG
+# before including this file:
+#  * amplitude_no_persistence - events are queued in memory only
+#  * amplitude_no_mccmnc - no country and carrier lookup tables
+#  * amplitude_no_location - no locationInfo, no location in events and
+#    no country code table
+#  * amplitude_no_identify - no identifyUser() and user properties delta
+#  * amplitude_no_metrics - no metrics()
+contains(CONFIG, amplitude_no_persistence): DEFINES += QAMPLITUDEANALYTICS_NO_PERSISTENCE
+contains(CONFIG, amplitude_no_mccmnc): DEFINES += QAMPLITUDEANALYTICS_NO_MCCMNC
+contains(CONFIG, amplitude_no_location): DEFINES += QAMPLITUDEANALYTICS_NO_LOCATION
+contains(CONFIG, amplitude_no_identify): DEFINES += QAMPLITUDEANALYTICS_NO_IDENTIFY
+contains(CONFIG, amplitude_no_metrics): DEFINES += QAMPLITUDEANALYTICS_NO_METRICS
+
 INCLUDEPATH += \
     $$PWD/includes
 
 HEADERS += \
     $$PWD/src/amplitudeanalytics/qamplitudeanalytics.h \
+    $$PWD/src/amplitudeanalytics/batchcontroller_p.h \
+    $$PWD/src/amplitudeanalytics/eventclock_p.h \
+    $$PWD/src/amplitudeanalytics/idgenerator_p.h \
     $$PWD/src/amplitudeanalytics/jsonfunctions_p.h \
     $$PWD/src/amplitudeanalytics/mccmncfunctions_p.h
 
@@ -51,3 +68,24 @@ SOURCES += \
 
 RESOURCES += \
     $$PWD/src/amplitudeanalytics/amplitudeanalytics.qrc
+
+contains(CONFIG, amplitude_no_persistence) {
+    HEADERS += \
+        $$PWD/src/amplitudeanalytics/memoryeventqueue_p.h
+} else {
+    HEADERS += \
+        $$PWD/src/amplitudeanalytics/crc32cfunctions_p.h \
+        $$PWD/src/amplitudeanalytics/eventqueue_p.h
+    SOURCES += \
+        $$PWD/src/amplitudeanalytics/eventqueue.cpp
+}
+
+!contains(CONFIG, amplitude_no_mccmnc) {
+    RESOURCES += \
+        $$PWD/src/amplitudeanalytics/mccmnc.qrc
+    # Country codes are only used for locationInfo
+    !contains(CONFIG, amplitude_no_location) {
+        RESOURCES += \
+            $$PWD/src/amplitudeanalytics/countrycodes.qrc
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BATCHCONTROLLER_P_H
+#define BATCHCONTROLLER_P_H
+
+#include <QtGlobal>
+
+// Sizes upload batches and the number of requests in flight from the
+// outcome of previous requests, similar to TCP congestion control:
+// additive increase while requests succeed within the target round-trip
+// time, multiplicative decrease on errors or when they get too slow.
+// Batches are also kept small enough to upload within the target time
+// at the measured bandwidth.
+class QAmplitudeBatchController
+{
+public:
+    enum {
+        MinBatchBytes = 4 * 1024,
+        MaxBatchBytes = 1024 * 1024,
+        BatchBytesStep = 16 * 1024,
+        MaxInFlight = 4,
+        // Successful requests in a row before allowing one more in flight
+        InFlightStep = 4,
+        TargetRoundTripTime = 5000,
+        MinRequestTimeout = 15000,
+        MaxRequestTimeout = 60000
+    };
+
+    QAmplitudeBatchController()
+        : m_batchBytes(64 * 1024)
+        , m_maxInFlight(1)
+        , m_successes(0)
+        , m_roundTripTime(-1)
+        , m_bandwidth(-1)
+        , m_errorRate(0)
+    {}
+
+    int batchBytes() const { return m_batchBytes; }
+    int maxInFlight() const { return m_maxInFlight; }
+
+    // Smoothed, in milliseconds, or -1 until the first request succeeds
+    int roundTripTime() const { return m_roundTripTime; }
+    // Smoothed, in bytes per second, or -1 until the first request succeeds
+    qint64 bandwidth() const { return m_bandwidth; }
+    // Exponentially weighted share of failed requests, 0..1
+    qreal errorRate() const { return m_errorRate; }
+
+    int requestTimeout() const
+    {
+        if (m_roundTripTime < 0)
+            return MaxRequestTimeout / 2;
+        return qBound<int>(MinRequestTimeout, 4 * m_roundTripTime, MaxRequestTimeout);
+    }
+
+    void succeeded(qint64 bytes, qint64 elapsed)
+    {
+        elapsed = qMax<qint64>(elapsed, 1);
+        m_roundTripTime = m_roundTripTime < 0 ? int(elapsed)
+                                              : int((7 * qint64(m_roundTripTime) + elapsed) / 8);
+        const qint64 bandwidth = bytes * 1000 / elapsed;
+        m_bandwidth = m_bandwidth < 0 ? bandwidth : (7 * m_bandwidth + bandwidth) / 8;
+        m_errorRate = m_errorRate * 7 / 8;
+
+        if (elapsed > TargetRoundTripTime) {
+            decrease();
+            return;
+        }
+
+        m_batchBytes = qMin<int>(m_batchBytes + BatchBytesStep, MaxBatchBytes);
+        if (m_bandwidth > 0) {
+            const qint64 fitting = m_bandwidth * TargetRoundTripTime / 1000;
+            m_batchBytes = int(qBound<qint64>(MinBatchBytes, qMin<qint64>(m_batchBytes, fitting),
+                                              MaxBatchBytes));
+        }
+        if (++m_successes >= InFlightStep) {
+            m_successes = 0;
+            m_maxInFlight = qMin<int>(m_maxInFlight + 1, MaxInFlight);
+        }
+    }
+
+    void failed()
+    {
+        m_errorRate = (m_errorRate * 7 + 1) / 8;
+        decrease();
+    }
+
+private:
+    int m_batchBytes;
+    int m_maxInFlight;
+    int m_successes;
+    int m_roundTripTime;
+    qint64 m_bandwidth;
+    qreal m_errorRate;
+
+    void decrease()
+    {
+        m_successes = 0;
+        m_batchBytes = qMax<int>(m_batchBytes / 2, MinBatchBytes);
+        m_maxInFlight = qMax(m_maxInFlight / 2, 1);
+    }
+};
+
+#endif // BATCHCONTROLLER_P_H
@@ -0,0 +1,87 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EVENTCLOCK_P_H
+#define EVENTCLOCK_P_H
+
+#include <QDateTime>
+#include <QElapsedTimer>
+
+#include <ctime>
+
+// Milliseconds since epoch for event timestamps, without going through
+// QDateTime (and its time zone handling) for every event. Kept as an
+// offset from a monotonic timer. The offset is corrected when it drifts
+// from time() by more than a second, e.g. after the system clock was
+// changed. The drift is checked at most once per DriftCheckInterval of
+// monotonic time, so that most events only read the monotonic clock.
+// Suspend (when the monotonic clock may not advance) is handled by
+// calling synchronize() on application activation.
+class QAmplitudeEventClock
+{
+public:
+    enum { DriftCheckInterval = 1000 };
+
+    QAmplitudeEventClock()
+        : m_offset(0)
+        , m_nextDriftCheck(0)
+    {
+        m_timer.start();
+        synchronize();
+    }
+
+    qint64 currentMSecsSinceEpoch()
+    {
+        const qint64 elapsed = m_timer.elapsed();
+        if (elapsed < m_nextDriftCheck)
+            return m_offset + elapsed;
+
+        m_nextDriftCheck = elapsed + DriftCheckInterval;
+        const qint64 msecs = m_offset + elapsed;
+        const qint64 drift = msecs / 1000 - qint64(std::time(0));
+        if (drift > 1 || drift < -1) {
+            synchronize();
+            return m_offset + m_timer.elapsed();
+        }
+        return msecs;
+    }
+
+    void synchronize()
+    {
+        const qint64 elapsed = m_timer.elapsed();
+        m_offset = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch() - elapsed;
+        m_nextDriftCheck = elapsed + DriftCheckInterval;
+    }
+
+private:
+    QElapsedTimer m_timer;
+    qint64 m_offset;
+    qint64 m_nextDriftCheck;
+};
+
+#endif // EVENTCLOCK_P_H
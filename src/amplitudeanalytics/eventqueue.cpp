@@ -0,0 +1,790 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "eventqueue_p.h"
+
+#include "crc32cfunctions_p.h"
+
+#include <QDir>
+#include <QDebug>
+#include <QtEndian>
+
+#include <limits>
+
+#ifdef Q_OS_WIN
+#   include <io.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+namespace {
+
+const char SegmentMagic[] = { 'Q', 'A', 'E', 'Q' };
+const char SegmentVersion = 1;
+const char SegmentCompressed = 1;
+const int SegmentFlagsOffset = 5;
+const int SegmentHeaderSize = 8;
+const int RecordHeaderSize = 8;
+const qint64 SegmentSize = 256 * 1024;
+const int CursorSlotSize = 16;
+
+bool syncFile(QFile &file)
+{
+    if (!file.flush())
+        return false;
+#ifdef Q_OS_WIN
+    return ::_commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+
+void syncDirectory(const QString &path)
+{
+#ifdef Q_OS_WIN
+    Q_UNUSED(path)
+#else
+    // Makes creation and renaming of segment files durable
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
+
+bool isValidSegmentHeader(const uchar *data, qint64 size)
+{
+    return data && size >= SegmentHeaderSize
+           && qstrncmp(reinterpret_cast<const char *>(data), SegmentMagic, sizeof(SegmentMagic)) == 0
+           && data[sizeof(SegmentMagic)] == SegmentVersion
+           && data[SegmentFlagsOffset] == 0;
+}
+
+// Walks records in data from offset up to limit and returns offset
+// right after the last intact record.
+qint64 scanRecords(const uchar *data, qint64 offset, qint64 limit, bool verify, int *records)
+{
+    *records = 0;
+    while (offset + RecordHeaderSize <= limit) {
+        const quint32 length = qFromLittleEndian<quint32>(data + offset);
+        const qint64 next = offset + RecordHeaderSize + length;
+        if (next > limit)
+            break;
+        if (verify && qFromLittleEndian<quint32>(data + offset + 4)
+                      != crc32c(reinterpret_cast<const char *>(data) + offset + RecordHeaderSize, length))
+            break;
+        offset = next;
+        ++*records;
+    }
+    return offset;
+}
+
+} // namespace
+
+QAmplitudeEventQueue::QAmplitudeEventQueue(const QString &path, OpenMode mode)
+    : m_path(path)
+    , m_cachedSegment(0)
+    , m_readOnly(mode == ReadOnly)
+    , m_unsynced(false)
+    , m_compressionEnabled(false)
+{
+    recover();
+}
+
+QAmplitudeEventQueue::~QAmplitudeEventQueue()
+{
+    releaseSegments();
+    flush(false);
+    foreach (const Reader &reader, m_readers)
+        delete reader.file;
+}
+
+QString QAmplitudeEventQueue::path() const
+{
+    return m_path;
+}
+
+bool QAmplitudeEventQueue::isReadOnly() const
+{
+    return m_readOnly;
+}
+
+void QAmplitudeEventQueue::addReader(const QString &reader)
+{
+    if (m_readers.contains(reader))
+        return;
+
+    // New readers only get records appended from now on
+    Reader &added = m_readers[reader];
+    added.cursor = m_end;
+    added.head = m_end;
+    if (!m_readOnly) {
+        openCursorFile(reader, &added);
+        saveCursor(&added);
+    }
+}
+
+void QAmplitudeEventQueue::removeReader(const QString &reader)
+{
+    if (reader.isEmpty() || !m_readers.contains(reader))
+        return;
+
+    const Reader removed = m_readers.take(reader);
+    if (removed.file) {
+        if (!m_readOnly)
+            removed.file->remove();
+        delete removed.file;
+    }
+    releaseSegments();
+    removeConsumedSegments();
+}
+
+QStringList QAmplitudeEventQueue::readers() const
+{
+    return m_readers.keys();
+}
+
+int QAmplitudeEventQueue::count(const QString &reader) const
+{
+    return int(m_end.index - m_readers.value(reader).cursor.index);
+}
+
+bool QAmplitudeEventQueue::isEmpty(const QString &reader) const
+{
+    return m_readers.value(reader).cursor.index == m_end.index;
+}
+
+bool QAmplitudeEventQueue::isEmpty() const
+{
+    foreach (const Reader &reader, m_readers) {
+        if (reader.cursor.index != m_end.index)
+            return false;
+    }
+    return true;
+}
+
+qint64 QAmplitudeEventQueue::size() const
+{
+    qint64 size = 0;
+    foreach (const Segment &segment, m_segments)
+        size += segment.size;
+    return size;
+}
+
+qint64 QAmplitudeEventQueue::storedSize() const
+{
+    qint64 size = 0;
+    foreach (const Segment &segment, m_segments)
+        size += segment.storedSize;
+    return size;
+}
+
+bool QAmplitudeEventQueue::isCompressionEnabled() const
+{
+    return m_compressionEnabled;
+}
+
+void QAmplitudeEventQueue::setCompressionEnabled(bool enabled)
+{
+    m_compressionEnabled = enabled;
+}
+
+void QAmplitudeEventQueue::append(const QByteArray &record)
+{
+    if (m_readOnly)
+        return;
+
+    const qint64 recordSize = RecordHeaderSize + record.size();
+    if (m_segments.value(m_end.segment).records > 0
+            && m_segments.value(m_end.segment).size + recordSize > SegmentSize) {
+        rotate();
+    }
+
+    uchar header[RecordHeaderSize];
+    qToLittleEndian<quint32>(record.size(), header);
+    qToLittleEndian<quint32>(crc32c(record.constData(), record.size()), header + 4);
+
+    Segment &segment = m_segments[m_end.segment];
+    if (m_tail.write(reinterpret_cast<const char *>(header), RecordHeaderSize) != RecordHeaderSize
+            || m_tail.write(record) != record.size()) {
+        // Don't leave a partial record in front of the ones that follow
+        qWarning() << "Failed to write event to" << m_tail.fileName() << m_tail.errorString();
+        m_tail.flush();
+        m_tail.resize(segment.size);
+        return;
+    }
+
+    segment.size += recordSize;
+    segment.storedSize = segment.size;
+    ++segment.records;
+    m_end.offset = segment.size;
+    ++m_end.index;
+    m_unsynced = true;
+}
+
+QList<QByteArray> QAmplitudeEventQueue::read(const QString &reader, int maxRecords, qint64 maxBytes,
+                                             qint64 *end)
+{
+    if (!m_readers.contains(reader))
+        return QList<QByteArray>();
+
+    Reader &r = m_readers[reader];
+    const QList<QByteArray> records = read(r.head.index < r.cursor.index ? r.cursor : r.head,
+                                           &r.head, maxRecords, maxBytes);
+    r.pending.insert(r.head.index, r.head);
+    if (end)
+        *end = r.head.index;
+    return records;
+}
+
+void QAmplitudeEventQueue::commit(const QString &reader)
+{
+    if (m_readers.contains(reader))
+        commit(reader, m_readers.value(reader).head.index);
+}
+
+void QAmplitudeEventQueue::commit(const QString &reader, qint64 end)
+{
+    if (!m_readers.contains(reader))
+        return;
+
+    Reader &r = m_readers[reader];
+    commit(&r, end == r.head.index ? r.head : r.pending.value(end, r.cursor));
+}
+
+void QAmplitudeEventQueue::rewind(const QString &reader)
+{
+    if (m_readers.contains(reader)) {
+        Reader &r = m_readers[reader];
+        r.head = r.cursor;
+        r.pending.clear();
+    }
+}
+
+void QAmplitudeEventQueue::rewind(const QString &reader, qint64 end)
+{
+    if (!m_readers.contains(reader))
+        return;
+
+    // Reads that ended after end are forgotten
+    Reader &r = m_readers[reader];
+    r.head = r.pending.value(end, r.cursor);
+    if (r.head.index < r.cursor.index)
+        r.head = r.cursor;
+    while (!r.pending.isEmpty() && (r.pending.constEnd() - 1).key() > r.head.index)
+        r.pending.erase(r.pending.end() - 1);
+}
+
+void QAmplitudeEventQueue::clear()
+{
+    for (QMap<QString, Reader>::iterator it = m_readers.begin(); it != m_readers.end(); ++it)
+        commit(&it.value(), m_end);
+}
+
+void QAmplitudeEventQueue::flush(bool sync)
+{
+    if (m_readOnly)
+        return;
+
+    m_tail.flush();
+    foreach (const Reader &reader, m_readers) {
+        if (reader.file)
+            reader.file->flush();
+    }
+    if (!sync || !m_unsynced)
+        return;
+
+    syncFile(m_tail);
+    foreach (const Reader &reader, m_readers) {
+        if (reader.file)
+            syncFile(*reader.file);
+    }
+    m_unsynced = false;
+}
+
+QString QAmplitudeEventQueue::segmentFileName(quint32 number, bool compressed) const
+{
+    return QDir(m_path).filePath(QString::fromLatin1(compressed ? "%1.segz" : "%1.seg")
+                                 .arg(number, 8, 16, QLatin1Char('0')));
+}
+
+QString QAmplitudeEventQueue::cursorFileName(const QString &reader) const
+{
+    return QDir(m_path).filePath(reader.isEmpty() ? QString::fromLatin1("cursor")
+                                                  : QString::fromLatin1("cursor-") + reader);
+}
+
+QList<QByteArray> QAmplitudeEventQueue::read(const Position &from, Position *next,
+                                             int maxRecords, qint64 maxBytes)
+{
+    releaseSegments();
+
+    QList<QByteArray> records;
+    qint64 bytes = 0;
+    bool full = false;
+    Position position = from;
+
+    if (!m_readOnly)
+        m_tail.flush();
+    QMap<quint32, Segment>::const_iterator it = m_segments.lowerBound(position.segment);
+    for (; it != m_segments.constEnd() && !full; ++it) {
+        if (it.key() != position.segment)
+            position = Position(it.key(), SegmentHeaderSize, it->firstIndex);
+        if (position.offset >= it->size)
+            continue;
+
+        const uchar *data = segmentData(it.key(), *it);
+        bool corrupted = !data;
+        while (!corrupted && position.offset < it->size) {
+            if (maxRecords >= 0 && records.count() >= maxRecords) {
+                full = true;
+                break;
+            }
+
+            const qint64 offset = position.offset;
+            const quint32 length = offset + RecordHeaderSize <= it->size
+                                   ? qFromLittleEndian<quint32>(data + offset) : 0;
+            const char *payload = reinterpret_cast<const char *>(data) + offset + RecordHeaderSize;
+            if (offset + RecordHeaderSize + length > it->size
+                    || qFromLittleEndian<quint32>(data + offset + 4) != crc32c(payload, length)) {
+                corrupted = true;
+                break;
+            }
+            if (maxBytes >= 0 && !records.isEmpty() && bytes + length > maxBytes) {
+                full = true;
+                break;
+            }
+
+            records.append(QByteArray::fromRawData(payload, length));
+            bytes += length;
+            position.offset += RecordHeaderSize + length;
+            ++position.index;
+        }
+
+        if (corrupted) {
+            // Records read so far are returned on their own and the rest
+            // is skipped by the next read, so that returned records
+            // always have consecutive indexes
+            if (!records.isEmpty())
+                break;
+
+            // Unreadable or corrupted: nothing after this point
+            // in the segment can be trusted, so skip it entirely
+            qWarning() << "Skipping unreadable events in" << segmentFileName(it.key(), it->compressed);
+            position.offset = it->size;
+            position.index = it->firstIndex + it->records;
+        }
+    }
+
+    if (next)
+        *next = position;
+    return records;
+}
+
+void QAmplitudeEventQueue::commit(Reader *reader, const Position &position)
+{
+    if (position.index <= reader->cursor.index)
+        return;
+
+    reader->cursor = position;
+    QMap<quint32, Segment>::const_iterator it = m_segments.constFind(reader->cursor.segment);
+    while (it != m_segments.constEnd() && it.key() != m_end.segment
+           && reader->cursor.offset >= it->size) {
+        ++it;
+        reader->cursor = Position(it.key(), SegmentHeaderSize, it->firstIndex);
+    }
+    if (reader->head.index < reader->cursor.index)
+        reader->head = reader->cursor;
+    while (!reader->pending.isEmpty() && reader->pending.constBegin().key() <= reader->cursor.index)
+        reader->pending.erase(reader->pending.begin());
+    saveCursor(reader);
+
+    releaseSegments();
+    removeConsumedSegments();
+}
+
+void QAmplitudeEventQueue::removeConsumedSegments()
+{
+    // Segments behind all cursors are fully consumed. Deleting them before
+    // the cursors reach the disk is safe: recovery moves a cursor that
+    // points to a missing segment to the start of the first remaining one.
+    if (m_readOnly)
+        return;
+
+    quint32 first = m_end.segment;
+    foreach (const Reader &reader, m_readers)
+        first = qMin(first, reader.cursor.segment);
+
+    if (m_cachedSegment < first)
+        m_cachedSegmentData.clear();
+    while (!m_segments.isEmpty() && m_segments.constBegin().key() < first) {
+        QFile::remove(segmentFileName(m_segments.constBegin().key(),
+                                      m_segments.constBegin()->compressed));
+        m_segments.erase(m_segments.begin());
+    }
+}
+
+void QAmplitudeEventQueue::recover()
+{
+    QDir dir(m_path);
+    if (!m_readOnly) {
+        if (!dir.exists())
+            dir.mkpath(QLatin1String("."));
+
+        // Leftovers of segments whose creation or compression was interrupted
+        foreach (const QString &name, dir.entryList(QStringList(QLatin1String("*.tmp")), QDir::Files))
+            dir.remove(name);
+    }
+
+    // The default reader always exists, starting from the oldest record
+    loadReader(QString());
+    foreach (const QString &name, dir.entryList(QStringList(QLatin1String("cursor-*")), QDir::Files))
+        loadReader(name.mid(7));
+
+    quint32 first = std::numeric_limits<quint32>::max();
+    foreach (const Reader &reader, m_readers)
+        first = qMin(first, reader.cursor.segment);
+
+    QMap<quint32, bool> numbers;
+    const QStringList names = dir.entryList(QStringList() << QLatin1String("*.seg")
+                                                          << QLatin1String("*.segz"),
+                                            QDir::Files);
+    foreach (const QString &name, names) {
+        bool ok = false;
+        const quint32 number = name.left(name.indexOf(QLatin1Char('.'))).toUInt(&ok, 16);
+        if (ok)
+            numbers.insert(number, true);
+    }
+
+    qint64 index = 0;
+    for (QMap<quint32, bool>::const_iterator it = numbers.constBegin(); it != numbers.constEnd(); ++it) {
+        const quint32 number = it.key();
+        if (number < first) {
+            // Consumed, but deletion was interrupted
+            if (!m_readOnly) {
+                QFile::remove(segmentFileName(number, true));
+                QFile::remove(segmentFileName(number, false));
+            }
+            continue;
+        }
+
+        Segment segment;
+        segment.firstIndex = index;
+        QByteArray uncompressed;
+        QFile compressed(segmentFileName(number, true));
+        if (compressed.exists()) {
+            // Only renamed into place when complete, so the raw
+            // segment it was made of can be removed if still there
+            uncompressed = readCompressedSegment(&compressed);
+            if (isValidSegmentHeader(reinterpret_cast<const uchar *>(uncompressed.constData()),
+                                     uncompressed.size())) {
+                if (!m_readOnly)
+                    QFile::remove(segmentFileName(number, false));
+                segment.compressed = true;
+                segment.storedSize = compressed.size();
+            } else {
+                qWarning() << "Discarding corrupted event queue segment" << compressed.fileName();
+                if (!m_readOnly)
+                    compressed.remove();
+                uncompressed.clear();
+            }
+        }
+
+        QFile file(segmentFileName(number, false));
+        const uchar *data = reinterpret_cast<const uchar *>(uncompressed.constData());
+        qint64 size = uncompressed.size();
+        if (!segment.compressed) {
+            if (!file.exists())
+                continue;
+            if (!file.open(m_readOnly ? QFile::ReadOnly : QFile::ReadWrite)) {
+                qWarning() << "Failed to open" << file.fileName() << file.errorString();
+                continue;
+            }
+            size = file.size();
+            data = size > 0 ? file.map(0, size) : 0;
+            if (!isValidSegmentHeader(data, size)) {
+                qWarning() << "Discarding corrupted event queue segment" << file.fileName();
+                if (!m_readOnly)
+                    file.remove();
+                continue;
+            }
+        }
+
+        // Sealed segments were synced before the next one was created:
+        // only the last one can be torn, so only its records are verified
+        // here. Records of the others are verified when they are read.
+        const bool isTail = number == (numbers.constEnd() - 1).key() && !segment.compressed;
+        segment.size = scanRecords(data, SegmentHeaderSize, size, isTail, &segment.records);
+        if (!segment.compressed)
+            segment.storedSize = segment.size;
+
+        for (QMap<QString, Reader>::iterator r = m_readers.begin(); r != m_readers.end(); ++r) {
+            Position &cursor = r->cursor;
+            if (cursor.segment != number)
+                continue;
+            int consumed = 0;
+            cursor.offset = scanRecords(data, SegmentHeaderSize,
+                                        qBound<qint64>(SegmentHeaderSize, cursor.offset, segment.size),
+                                        false, &consumed);
+            cursor.index = index + consumed;
+        }
+
+        if (!segment.compressed) {
+            file.unmap(const_cast<uchar *>(data));
+            if (segment.size < size && !m_readOnly) {
+                qWarning() << "Truncating torn events at the end of" << file.fileName();
+                file.resize(segment.size);
+            }
+        }
+
+        index += segment.records;
+        m_segments.insert(number, segment);
+    }
+
+    // Compressed segments are sealed, they can't be appended to
+    if (m_segments.isEmpty())
+        createSegment(qMax<quint32>(first, 1), 0);
+    else if ((m_segments.constEnd() - 1)->compressed)
+        createSegment((m_segments.constEnd() - 1).key() + 1, index);
+
+    QMap<quint32, Segment>::const_iterator last = m_segments.constEnd() - 1;
+    m_end = Position(last.key(), last->size, last->firstIndex + last->records);
+    m_tail.setFileName(segmentFileName(last.key(), false));
+    if (!m_readOnly && !m_tail.open(QFile::ReadWrite | QFile::Append))
+        qWarning() << "Failed to open" << m_tail.fileName() << m_tail.errorString();
+
+    for (QMap<QString, Reader>::iterator r = m_readers.begin(); r != m_readers.end(); ++r) {
+        Position &cursor = r->cursor;
+        if (!m_segments.contains(cursor.segment)) {
+            // Its segment was discarded, continue with the next remaining one
+            QMap<quint32, Segment>::const_iterator next = m_segments.lowerBound(cursor.segment);
+            if (next != m_segments.constEnd())
+                cursor = Position(next.key(), SegmentHeaderSize, next->firstIndex);
+            else
+                cursor = m_end;
+        }
+        r->head = cursor;
+    }
+}
+
+void QAmplitudeEventQueue::loadReader(const QString &name)
+{
+    Reader &reader = m_readers[name];
+    if (!openCursorFile(name, &reader))
+        return;
+
+    const QByteArray data = reader.file->read(2 * CursorSlotSize);
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+    bool found = false;
+    for (int slot = 0; slot + CursorSlotSize <= data.size(); slot += CursorSlotSize) {
+        if (qFromLittleEndian<quint32>(p + slot + 12) != crc32c(data.constData() + slot, 12))
+            continue;
+
+        const quint32 sequence = qFromLittleEndian<quint32>(p + slot);
+        if (found && sequence < reader.sequence)
+            continue;
+
+        found = true;
+        reader.sequence = sequence;
+        reader.cursor = Position(qFromLittleEndian<quint32>(p + slot + 4),
+                                 qFromLittleEndian<quint32>(p + slot + 8));
+    }
+}
+
+bool QAmplitudeEventQueue::openCursorFile(const QString &name, Reader *reader)
+{
+    reader->file = new QFile(cursorFileName(name));
+    if (m_readOnly && !reader->file->exists()) {
+        delete reader->file;
+        reader->file = 0;
+        return false;
+    }
+    if (!reader->file->open(m_readOnly ? QFile::ReadOnly : QFile::ReadWrite)) {
+        qWarning() << "Failed to open" << reader->file->fileName() << reader->file->errorString();
+        delete reader->file;
+        reader->file = 0;
+        return false;
+    }
+    return true;
+}
+
+void QAmplitudeEventQueue::saveCursor(Reader *reader)
+{
+    if (!reader->file || m_readOnly)
+        return;
+
+    uchar slot[CursorSlotSize];
+    ++reader->sequence;
+    qToLittleEndian<quint32>(reader->sequence, slot);
+    qToLittleEndian<quint32>(reader->cursor.segment, slot + 4);
+    qToLittleEndian<quint32>(reader->cursor.offset, slot + 8);
+    qToLittleEndian<quint32>(crc32c(reinterpret_cast<const char *>(slot), 12), slot + 12);
+
+    // Two slots are written in turns, so a torn write
+    // can only destroy the newer of the two cursors
+    reader->file->seek((reader->sequence % 2) * CursorSlotSize);
+    reader->file->write(reinterpret_cast<const char *>(slot), CursorSlotSize);
+    reader->file->flush();
+    m_unsynced = true;
+}
+
+const uchar *QAmplitudeEventQueue::segmentData(quint32 number, const Segment &segment)
+{
+    if (segment.compressed) {
+        // Segments are read in batches, don't uncompress for every one
+        if (m_cachedSegmentData.isNull() || m_cachedSegment != number) {
+            QFile file(segmentFileName(number, true));
+            m_cachedSegment = number;
+            m_cachedSegmentData = readCompressedSegment(&file);
+        }
+        m_uncompressedSegments.append(m_cachedSegmentData);
+        const QByteArray &data = m_uncompressedSegments.last();
+        if (data.size() < segment.size)
+            return 0;
+        return reinterpret_cast<const uchar *>(data.constData());
+    }
+
+    QFile *file = new QFile(segmentFileName(number, false));
+    const uchar *data = file->open(QFile::ReadOnly) ? file->map(0, segment.size) : 0;
+    if (!data) {
+        delete file;
+        return 0;
+    }
+
+    // Unmapped when the file is destroyed
+    m_mappedSegments.append(file);
+    return data;
+}
+
+void QAmplitudeEventQueue::releaseSegments()
+{
+    qDeleteAll(m_mappedSegments);
+    m_mappedSegments.clear();
+    m_uncompressedSegments.clear();
+}
+
+QByteArray QAmplitudeEventQueue::readCompressedSegment(QFile *file) const
+{
+    if (!file->open(QFile::ReadOnly))
+        return QByteArray();
+
+    const QByteArray header = file->read(SegmentHeaderSize);
+    if (header.size() != SegmentHeaderSize
+            || qstrncmp(header.constData(), SegmentMagic, sizeof(SegmentMagic)) != 0
+            || header.at(sizeof(SegmentMagic)) != SegmentVersion
+            || header.at(SegmentFlagsOffset) != SegmentCompressed) {
+        return QByteArray();
+    }
+    return qUncompress(file->readAll());
+}
+
+void QAmplitudeEventQueue::compressSegment(quint32 number)
+{
+    QFile raw(segmentFileName(number, false));
+    if (!raw.open(QFile::ReadOnly))
+        return;
+    const QByteArray data = raw.readAll();
+    raw.close();
+
+    const QByteArray compressed = qCompress(data);
+    if (compressed.size() + SegmentHeaderSize >= data.size())
+        return;
+
+    // Same as with new segments: the compressed segment only appears under
+    // its final name when complete. Recovery prefers it over the raw one.
+    const QString fileName = segmentFileName(number, true);
+    QFile file(fileName + QLatin1String(".tmp"));
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        return;
+    QByteArray header(data.left(SegmentHeaderSize));
+    header[SegmentFlagsOffset] = SegmentCompressed;
+    if (file.write(header) != header.size() || file.write(compressed) != compressed.size()
+            || !syncFile(file)) {
+        file.remove();
+        return;
+    }
+    file.close();
+    if (!file.rename(fileName)) {
+        file.remove();
+        return;
+    }
+    syncDirectory(m_path);
+    raw.remove();
+
+    Segment &segment = m_segments[number];
+    segment.compressed = true;
+    segment.storedSize = SegmentHeaderSize + compressed.size();
+}
+
+void QAmplitudeEventQueue::createSegment(quint32 number, qint64 firstIndex)
+{
+    Segment segment;
+    segment.size = SegmentHeaderSize;
+    segment.storedSize = SegmentHeaderSize;
+    segment.firstIndex = firstIndex;
+    m_segments.insert(number, segment);
+    // Empty, so nothing is ever read from it
+    if (m_readOnly)
+        return;
+
+    // The segment only appears under its final name once its
+    // header is on disk, so there are no half-created segments
+    const QString fileName = segmentFileName(number, false);
+    QFile file(fileName + QLatin1String(".tmp"));
+    if (file.open(QFile::WriteOnly | QFile::Truncate)) {
+        QByteArray header(SegmentHeaderSize, '\0');
+        header.replace(0, sizeof(SegmentMagic), QByteArray(SegmentMagic, sizeof(SegmentMagic)));
+        header[int(sizeof(SegmentMagic))] = SegmentVersion;
+        file.write(header);
+        syncFile(file);
+        file.close();
+    }
+    if (!file.rename(fileName))
+        qWarning() << "Failed to create" << fileName << file.errorString();
+    syncDirectory(m_path);
+}
+
+void QAmplitudeEventQueue::rotate()
+{
+    // Seal the current tail: it must be complete on
+    // disk before anything is written to the next one
+    syncFile(m_tail);
+    m_tail.close();
+    if (m_compressionEnabled)
+        compressSegment(m_end.segment);
+
+    const quint32 number = m_end.segment + 1;
+    createSegment(number, m_end.index);
+    m_end = Position(number, SegmentHeaderSize, m_end.index);
+
+    m_tail.setFileName(segmentFileName(number, false));
+    if (!m_tail.open(QFile::ReadWrite | QFile::Append))
+        qWarning() << "Failed to open" << m_tail.fileName() << m_tail.errorString();
+}
@@ -0,0 +1,174 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EVENTQUEUE_P_H
+#define EVENTQUEUE_P_H
+
+#include <QFile>
+#include <QMap>
+#include <QStringList>
+
+// Persistent FIFO of serialized events. Events are appended to segment
+// files of limited size, each record carrying its length and CRC32C.
+// Only the last (tail) segment is ever written to; older segments are
+// sealed and synced to disk before a new one is created, so a crash can
+// only tear the tail, which is truncated to the last intact record on
+// recovery.
+//
+// Every record is delivered to each reader. Readers are identified by
+// name and have their own cursor, stored separately from the segments.
+// Records returned by read() stay in the queue until the reader calls
+// commit(); rewind() makes them available to the reader again. A reader
+// can have several reads outstanding and commit or rewind them by the
+// index returned in end, in order. Records returned by a single read()
+// have consecutive indexes, the first one being end minus their count.
+// Segments that all readers have committed are deleted instead of being
+// rewritten. The default reader (with an empty name) always exists,
+// other readers only get records appended after they were first added.
+//
+// Segments are read through memory mapping and returned records point
+// directly into the mapped files, so they are only valid until the next
+// call to read() or commit(). Memory use doesn't depend on the size of
+// the queue.
+//
+// With compression enabled, segments are compressed with zlib when they
+// are sealed. Records repeat most of their keys and common properties,
+// so a segment compresses well as a whole. Compressed segments are
+// uncompressed one at a time when read.
+//
+// A queue opened read-only, e.g. for inspection, is never modified on
+// disk: recovery doesn't truncate, delete or create files, appended
+// records are ignored and reader cursors are only moved in memory.
+class QAmplitudeEventQueue
+{
+public:
+    enum OpenMode {
+        ReadWrite,
+        ReadOnly
+    };
+
+    explicit QAmplitudeEventQueue(const QString &path, OpenMode mode = ReadWrite);
+    ~QAmplitudeEventQueue();
+
+    QString path() const;
+    bool isReadOnly() const;
+
+    void addReader(const QString &reader);
+    void removeReader(const QString &reader);
+    QStringList readers() const;
+
+    int count(const QString &reader = QString()) const;
+    bool isEmpty(const QString &reader) const;
+    bool isEmpty() const;
+
+    qint64 size() const;
+    qint64 storedSize() const;
+
+    bool isCompressionEnabled() const;
+    void setCompressionEnabled(bool enabled);
+
+    void append(const QByteArray &record);
+    QList<QByteArray> read(const QString &reader, int maxRecords = -1, qint64 maxBytes = -1,
+                           qint64 *end = 0);
+    void commit(const QString &reader);
+    void commit(const QString &reader, qint64 end);
+    void rewind(const QString &reader);
+    void rewind(const QString &reader, qint64 end);
+    void clear();
+
+    void flush(bool sync);
+
+private:
+    struct Position {
+        Position(quint32 segment = 0, quint32 offset = 0, qint64 index = 0)
+            : segment(segment), offset(offset), index(index) {}
+
+        quint32 segment;
+        quint32 offset;
+        // Sequence number of the record at this position
+        qint64 index;
+    };
+
+    struct Segment {
+        Segment(): size(0), storedSize(0), records(0), firstIndex(0), compressed(false) {}
+
+        // Size of records, uncompressed
+        qint64 size;
+        qint64 storedSize;
+        int records;
+        qint64 firstIndex;
+        bool compressed;
+    };
+
+    struct Reader {
+        Reader(): file(0), sequence(0) {}
+
+        QFile *file;
+        quint32 sequence;
+        Position cursor;
+        Position head;
+        // Ends of outstanding reads by their index
+        QMap<qint64, Position> pending;
+    };
+
+    QString m_path;
+    QMap<quint32, Segment> m_segments;
+    QMap<QString, Reader> m_readers;
+    Position m_end;
+
+    QFile m_tail;
+    QList<QFile *> m_mappedSegments;
+    QList<QByteArray> m_uncompressedSegments;
+    // Last segment that was uncompressed, kept for the reads that follow
+    quint32 m_cachedSegment;
+    QByteArray m_cachedSegmentData;
+    bool m_readOnly;
+    bool m_unsynced;
+    bool m_compressionEnabled;
+
+    QString segmentFileName(quint32 number, bool compressed) const;
+    QString cursorFileName(const QString &reader) const;
+    QList<QByteArray> read(const Position &from, Position *next,
+                           int maxRecords, qint64 maxBytes);
+    const uchar *segmentData(quint32 number, const Segment &segment);
+    void releaseSegments();
+    QByteArray readCompressedSegment(QFile *file) const;
+    void compressSegment(quint32 number);
+    void commit(Reader *reader, const Position &position);
+    void removeConsumedSegments();
+    void recover();
+    void loadReader(const QString &name);
+    bool openCursorFile(const QString &name, Reader *reader);
+    void saveCursor(Reader *reader);
+    void createSegment(quint32 number, qint64 firstIndex);
+    void rotate();
+
+    Q_DISABLE_COPY(QAmplitudeEventQueue)
+};
+
+#endif // EVENTQUEUE_P_H
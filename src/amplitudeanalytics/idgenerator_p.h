@@ -0,0 +1,100 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IDGENERATOR_P_H
+#define IDGENERATOR_P_H
+
+#include <QString>
+#include <QUuid>
+
+// Generates random (version 4) UUIDs for insert_id. QUuid::createUuid()
+// may read from the system's entropy source for every UUID, which can be
+// slow. These come from xorshift128+, seeded once from it. They are only
+// used for deduplication, so they don't need to be unpredictable.
+class QAmplitudeIdGenerator
+{
+public:
+    QAmplitudeIdGenerator()
+    {
+        const QUuid seed = QUuid::createUuid();
+        quint64 data4 = 0;
+        for (int i = 0; i < 8; ++i)
+            data4 = (data4 << 8) | seed.data4[i];
+        m_state[0] = splitMix((quint64(seed.data1) << 32) | (quint64(seed.data2) << 16)
+                              | seed.data3);
+        m_state[1] = splitMix(data4);
+        if (m_state[0] == 0 && m_state[1] == 0)
+            m_state[1] = 1;
+    }
+
+    // Lowercase, without curly braces
+    QString createUuid()
+    {
+        static const char digits[] = "0123456789abcdef";
+
+        quint64 high = next();
+        quint64 low = next();
+        // Version 4, variant 10xx
+        high = (high & ~Q_UINT64_C(0xF000)) | Q_UINT64_C(0x4000);
+        low = (low & ~(Q_UINT64_C(0x3) << 62)) | (Q_UINT64_C(0x2) << 62);
+
+        char uuid[36];
+        int length = 0;
+        for (int i = 0; i < 16; ++i) {
+            if (i == 4 || i == 6 || i == 8 || i == 10)
+                uuid[length++] = '-';
+            const uint byte = uint(((i < 8 ? high : low) >> (56 - 8 * (i % 8))) & 0xFF);
+            uuid[length++] = digits[byte >> 4];
+            uuid[length++] = digits[byte & 0xF];
+        }
+        return QString::fromLatin1(uuid, length);
+    }
+
+private:
+    quint64 m_state[2];
+
+    static quint64 splitMix(quint64 x)
+    {
+        x += Q_UINT64_C(0x9E3779B97F4A7C15);
+        x = (x ^ (x >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+        x = (x ^ (x >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+        return x ^ (x >> 31);
+    }
+
+    quint64 next()
+    {
+        quint64 x = m_state[0];
+        const quint64 y = m_state[1];
+        m_state[0] = y;
+        x ^= x << 23;
+        m_state[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
+        return m_state[1] + y;
+    }
+};
+
+#endif // IDGENERATOR_P_H
@@ -29,11 +29,18 @@
 #ifndef JSONFUNCTIONS_P_H
 #define JSONFUNCTIONS_P_H
 
+#include <QDebug>
 #include <QLocale>
 #include <QDate>
 #include <QVariant>
 #include <QRegExp>
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+#   include <QJsonDocument>
+#   include <QJsonObject>
+#   include <QJsonArray>
+#endif
+
 inline QString toJsonString(const QVariant &value);
 
 inline void capitalize(QString &str)
@@ -155,4 +162,39 @@ inline QString doubleToString(const QVariant &value, int precision)
     }
 }
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+// Indexes of events rejected in an error response of the server, e.g.
+// {"code":400,"events_with_invalid_fields":{"time":[3,7]}}
+inline QList<int> rejectedEventIndexes(const QByteArray &response)
+{
+    QList<int> indexes;
+    const QJsonObject object = QJsonDocument::fromJson(response).object();
+    for (QJsonObject::const_iterator i = object.constBegin(); i != object.constEnd(); ++i) {
+        if (i.key() != QLatin1String("events_with_invalid_fields")
+                && i.key() != QLatin1String("events_with_missing_fields")) {
+            continue;
+        }
+
+        // Indexes are grouped by the offending field
+        const QJsonObject fields = i.value().toObject();
+        for (QJsonObject::const_iterator j = fields.constBegin(); j != fields.constEnd(); ++j) {
+            foreach (const QJsonValue &value, j.value().toArray()) {
+                const int index = int(value.toDouble(-1));
+                if (index >= 0 && !indexes.contains(index))
+                    indexes.append(index);
+            }
+        }
+    }
+    return indexes;
+}
+
+// Keys of user properties that an $identify event sets
+inline QStringList setUserPropertyKeys(const QByteArray &identify)
+{
+    return QJsonDocument::fromJson(identify).object()
+            .value(QLatin1String("user_properties")).toObject()
+            .value(QLatin1String("$set")).toObject().keys();
+}
+#endif
+
 #endif // JSONFUNCTIONS_P_H
@@ -31,6 +31,15 @@
 
 #include <QFile>
 
+#ifdef QAMPLITUDEANALYTICS_NO_MCCMNC
+
+// Lookup tables are left out of the build
+inline QString findCountryByIso3166(const QString &) { return QString(); }
+inline QString findCountryByMcc(const QString &) { return QString(); }
+inline QString findCarrierByMccMnc(const QString &, const QString &) { return QString(); }
+
+#else
+
 inline QString findCountryByIso3166(const QString &iso)
 {
     if (iso.isEmpty())
@@ -90,4 +99,6 @@ inline QString findCarrierByMccMnc(const QString &mcc, const QString &mnc)
     return QString();
 }
 
+#endif // QAMPLITUDEANALYTICS_NO_MCCMNC
+
 #endif // MCCMNCFUNCTIONS_P_H
@@ -0,0 +1,223 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MEMORYEVENTQUEUE_P_H
+#define MEMORYEVENTQUEUE_P_H
+
+#include <QList>
+#include <QMap>
+#include <QStringList>
+
+// In-memory replacement of the persistent QAmplitudeEventQueue, used
+// when persistence is left out of the build. Has the same interface
+// and reader semantics, but nothing survives a restart. Compression
+// has no effect.
+class QAmplitudeEventQueue
+{
+public:
+    explicit QAmplitudeEventQueue(const QString &path)
+        : m_path(path), m_first(0), m_size(0), m_compressionEnabled(false)
+    {
+        m_readers.insert(QString(), Reader());
+    }
+
+    QString path() const { return m_path; }
+
+    void addReader(const QString &reader)
+    {
+        if (m_readers.contains(reader))
+            return;
+
+        // New readers only get records appended from now on
+        Reader &added = m_readers[reader];
+        added.cursor = end();
+        added.head = end();
+    }
+
+    void removeReader(const QString &reader)
+    {
+        if (reader.isEmpty())
+            return;
+
+        m_readers.remove(reader);
+        removeConsumedRecords();
+    }
+
+    QStringList readers() const { return m_readers.keys(); }
+
+    int count(const QString &reader = QString()) const
+    {
+        return int(end() - m_readers.value(reader).cursor);
+    }
+
+    bool isEmpty(const QString &reader) const
+    {
+        return m_readers.value(reader).cursor == end();
+    }
+
+    bool isEmpty() const
+    {
+        foreach (const Reader &reader, m_readers) {
+            if (reader.cursor != end())
+                return false;
+        }
+        return true;
+    }
+
+    qint64 size() const { return m_size; }
+    qint64 storedSize() const { return m_size; }
+
+    bool isCompressionEnabled() const { return m_compressionEnabled; }
+    void setCompressionEnabled(bool enabled) { m_compressionEnabled = enabled; }
+
+    void append(const QByteArray &record)
+    {
+        m_records.append(record);
+        m_size += record.size();
+    }
+
+    QList<QByteArray> read(const QString &reader, int maxRecords = -1, qint64 maxBytes = -1,
+                           qint64 *end = 0)
+    {
+        QList<QByteArray> records;
+        if (!m_readers.contains(reader))
+            return records;
+
+        Reader &r = m_readers[reader];
+        qint64 bytes = 0;
+        qint64 index = qMax(r.head, r.cursor);
+        for (; index < this->end(); ++index) {
+            if (maxRecords >= 0 && records.count() >= maxRecords)
+                break;
+            const QByteArray &record = m_records.at(int(index - m_first));
+            if (maxBytes >= 0 && !records.isEmpty() && bytes + record.size() > maxBytes)
+                break;
+            records.append(record);
+            bytes += record.size();
+        }
+        r.head = index;
+        r.pending.insert(index, true);
+        if (end)
+            *end = index;
+        return records;
+    }
+
+    void commit(const QString &reader)
+    {
+        if (m_readers.contains(reader))
+            commit(reader, m_readers.value(reader).head);
+    }
+
+    void commit(const QString &reader, qint64 end)
+    {
+        if (!m_readers.contains(reader))
+            return;
+
+        Reader &r = m_readers[reader];
+        if (end != r.head && !r.pending.contains(end))
+            return;
+        commit(&r, end);
+    }
+
+    void rewind(const QString &reader)
+    {
+        if (m_readers.contains(reader)) {
+            Reader &r = m_readers[reader];
+            r.head = r.cursor;
+            r.pending.clear();
+        }
+    }
+
+    void rewind(const QString &reader, qint64 end)
+    {
+        if (!m_readers.contains(reader))
+            return;
+
+        // Reads that ended after end are forgotten
+        Reader &r = m_readers[reader];
+        r.head = r.pending.contains(end) ? qMax(end, r.cursor) : r.cursor;
+        while (!r.pending.isEmpty() && (r.pending.constEnd() - 1).key() > r.head)
+            r.pending.erase(r.pending.end() - 1);
+    }
+
+    void clear()
+    {
+        for (QMap<QString, Reader>::iterator it = m_readers.begin(); it != m_readers.end(); ++it)
+            commit(&it.value(), end());
+    }
+
+    void flush(bool) {}
+
+private:
+    struct Reader {
+        Reader(): cursor(0), head(0) {}
+
+        qint64 cursor;
+        qint64 head;
+        // Ends of outstanding reads
+        QMap<qint64, bool> pending;
+    };
+
+    QString m_path;
+    QList<QByteArray> m_records;
+    // Index of the first record in m_records
+    qint64 m_first;
+    qint64 m_size;
+    QMap<QString, Reader> m_readers;
+    bool m_compressionEnabled;
+
+    qint64 end() const { return m_first + m_records.count(); }
+
+    void commit(Reader *reader, qint64 end)
+    {
+        if (end <= reader->cursor)
+            return;
+
+        reader->cursor = end;
+        if (reader->head < reader->cursor)
+            reader->head = reader->cursor;
+        while (!reader->pending.isEmpty() && reader->pending.constBegin().key() <= reader->cursor)
+            reader->pending.erase(reader->pending.begin());
+        removeConsumedRecords();
+    }
+
+    void removeConsumedRecords()
+    {
+        qint64 consumed = end();
+        foreach (const Reader &reader, m_readers)
+            consumed = qMin(consumed, reader.cursor);
+        while (m_first < consumed) {
+            m_size -= m_records.takeFirst().size();
+            ++m_first;
+        }
+    }
+
+    Q_DISABLE_COPY(QAmplitudeEventQueue)
+};
+
+#endif // MEMORYEVENTQUEUE_P_H
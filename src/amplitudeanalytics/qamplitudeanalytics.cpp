@@ -28,19 +28,39 @@
 
 #include "qamplitudeanalytics.h"
 
+#include "batchcontroller_p.h"
+#include "eventclock_p.h"
+#include "idgenerator_p.h"
 #include "jsonfunctions_p.h"
 #include "mccmncfunctions_p.h"
 
+#ifdef QAMPLITUDEANALYTICS_NO_PERSISTENCE
+#   include "memoryeventqueue_p.h"
+#else
+#   include "eventqueue_p.h"
+#endif
+
 #include <QFile>
 #include <QDir>
+#include <QFileInfo>
 #include <QDateTime>
 #include <QUuid>
+#include <QTimer>
 #include <QSettings>
+#include <QCryptographicHash>
 #include <QCoreApplication>
+#include <QEvent>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QSslCertificate>
 
+// Bearer management is deprecated since Qt 5.15,
+// the network state is unknown without it
+#if !defined(QT_NO_BEARERMANAGEMENT) && QT_VERSION < QT_VERSION_CHECK(5, 15, 0)
+#   define QAMPLITUDEANALYTICS_BEARER_MANAGEMENT
+#   include <QNetworkConfigurationManager>
+#endif
+
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 #   include <QDesktopServices>
 #else
@@ -64,17 +84,94 @@
 #   include <bb/platform/PlatformInfo>
 #endif
 
+#ifdef QAMPLITUDEANALYTICS_TESTING
+// Lets autotests skip request pauses instead of waiting for them
+qint64 qamplitudeanalytics_requestClockSkew = 0;
+#endif
+
+namespace {
+
+const char DefaultUrl[] = "https://api.amplitude.com/httpapi";
+
+// Upper limit for a single upload request, its size in bytes
+// is chosen by QAmplitudeBatchController
+const int MaxBatchEvents = 1000;
+
+// Pause after the server throttled requests without a Retry-After
+// header or rejected them without naming invalid events. Doubled while
+// it keeps doing that.
+const int MinBackoff = 30000;
+const int MaxBackoff = 600000;
+const qint64 MaxRetryAfter = 3600000;
+
+// Events kept in memory are written to the event queue once they
+// reach either limit, whatever the persistence mode is
+const int MaxBufferedEvents = 1000;
+const int MaxBufferedBytes = 1024 * 1024;
+
+// Event ids are reserved (saved) in blocks of this size
+const quint32 EventIdBlock = 1000;
+
+// How long the radio is assumed to stay active after network traffic
+const int PiggybackWindow = 10000;
+
+// Delay requested by Retry-After header in milliseconds, -1 if none
+qint64 retryAfter(const QNetworkReply *reply)
+{
+    const QByteArray value = reply->rawHeader("Retry-After").trimmed();
+    if (value.isEmpty())
+        return -1;
+
+    bool ok = false;
+    const qint64 seconds = value.toLongLong(&ok);
+    if (ok)
+        return qBound(Q_INT64_C(0), seconds * 1000, MaxRetryAfter);
+
+    // HTTP-date, e.g. "Wed, 21 Oct 2015 07:28:00 GMT"
+    QDateTime date = QLocale::c().toDateTime(QString::fromLatin1(value),
+                                             QLatin1String("ddd, dd MMM yyyy HH:mm:ss 'GMT'"));
+    if (!date.isValid())
+        return -1;
+    date.setTimeSpec(Qt::UTC);
+    return qBound(Q_INT64_C(0), QDateTime::currentDateTimeUtc().msecsTo(date), MaxRetryAfter);
+}
+
+} // namespace
+
 QAmplitudeAnalytics::QAmplitudeAnalytics(const QString &apiKey,
                                          const QString &configFilePath,
                                          QObject *parent)
     : QObject(parent)
     , m_apiKey(apiKey)
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    , m_userPropertiesDeltaEnabled(false)
+    , m_userPropertiesChanged(false)
+    , m_sentUserPropertiesChanged(false)
+#endif
     , m_privacyEnabled(false)
-    , m_sessionId(QDateTime::currentDateTimeUtc().toMSecsSinceEpoch())
+    , m_sessionId(-1)
+    , m_lastEventTime(0)
     , m_lastEventId(0)
-    , m_shouldSend(false)
+    , m_reservedEventId(0)
+    , m_sessionTimeout(300000)
+    , m_sessionEventsEnabled(true)
+    , m_queueBytes(0)
+#ifndef QAMPLITUDEANALYTICS_NO_METRICS
+    , m_rejectedEvents(0)
+#endif
+    , m_persistenceMode(PersistImmediately)
+    , m_persistInterval(5000)
+    , m_persistEventThreshold(50)
+    , m_unsavedChanges(0)
+    , m_persistTimer(new QTimer(this))
     , m_nam(new QNetworkAccessManager())
-    , m_reply(NULL)
+    , m_requestTimer(new QTimer(this))
+    , m_idGenerator(new QAmplitudeIdGenerator())
+    , m_eventClock(new QAmplitudeEventClock())
+    , m_uploadPolicy(UploadAlways)
+    , m_detectedNetworkState(NetworkStateUnknown)
+    , m_networkStateOverride(NetworkStateUnknown)
+    , m_networkManager(NULL)
 {
     if (configFilePath.isEmpty()) {
         QString dataPath;
@@ -103,7 +200,7 @@ QAmplitudeAnalytics::QAmplitudeAnalytics(const QString &apiKey,
                    << QSslCertificate::fromPath(
                           QLatin1String(":/qtamplitudeanalytics/certificates/comodo.ca.pem")));
     m_sslConfiguration.setCaCertificates(cacerts);
-#if QT_VERSION < QT_VERSION_CHECK(4,8,0)
+#if QT_VERSION < QT_VERSION_CHECK(4, 8, 0)
     // More and more servers are disabling SSLv3 due to vulnerabilities,
     // however Qt < 4.8 has only SSLv3 enabled by default. As there is no
     // QSsl::TlsV1SslV3 enum value in Qt 4.7, we switch to TLSv1 only.
@@ -146,7 +243,9 @@ QAmplitudeAnalytics::QAmplitudeAnalytics(const QString &apiKey,
         m_device.model = di.productName();
 
     QNetworkInfo ni;
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     m_location.country = findCountryByMcc(ni.homeMobileCountryCode(0));
+#endif
 
     QVector<QNetworkInfo::NetworkMode> modes;
     modes << QNetworkInfo::GsmMode
@@ -180,9 +279,11 @@ QAmplitudeAnalytics::QAmplitudeAnalytics(const QString &apiKey,
     m_language = QLocale::languageToString(loc.language());
 
     QtMobility::QSystemNetworkInfo sni;
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     m_location.country = findCountryByMcc(sni.homeMobileCountryCode());
     if (m_location.country.isEmpty())
         m_location.country = findCountryByIso3166(si.currentCountryCode());
+#endif
 
     QVector<QtMobility::QSystemNetworkInfo::NetworkMode> modes;
     modes << QtMobility::QSystemNetworkInfo::GsmMode
@@ -220,7 +321,9 @@ QAmplitudeAnalytics::QAmplitudeAnalytics(const QString &apiKey,
         m_device.carrier = cni.name();
     else
         m_device.carrier = findCarrierByMccMnc(cni.mobileCountryCode(), cni.mobileNetworkCode());
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     m_location.country = findCountryByMcc(cni.mobileCountryCode());
+#endif
 #endif
 
     if (m_device.id.isEmpty()) {
@@ -233,24 +336,71 @@ QAmplitudeAnalytics::QAmplitudeAnalytics(const QString &apiKey,
         }
     }
 
+    // Continue the previous session if it hasn't timed out yet
+    m_sessionId = m_settings->value(QLatin1String("SessionId"), -1).toLongLong();
+    m_lastEventTime = m_settings->value(QLatin1String("LastEventTime"), 0).toLongLong();
+    m_lastEventId = m_settings->value(QLatin1String("LastEventId"), 0).toUInt();
+    m_reservedEventId = m_lastEventId;
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    m_sentUserProperties = m_settings->value(QLatin1String("SentUserProperties")).toMap();
+#endif
+
     const QLocale sysloc(QLocale::system());
     if (m_language.isEmpty() && sysloc.language() != QLocale::C)
         m_language = QLocale::languageToString(sysloc.language());
     capitalize(m_language);
 
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     if (m_location.country.isEmpty() && sysloc.country() != QLocale::AnyCountry) {
         const QStringList lang = sysloc.name().split(QLatin1Char('_'));
         if (lang.count() > 1) {
             m_location.country = findCountryByIso3166(lang.at(1));
         }
     }
+#endif
+
+    const QFileInfo settingsFile(m_settings->fileName());
+    m_eventQueue.reset(new QAmplitudeEventQueue(settingsFile.absoluteDir().filePath(
+                                                    settingsFile.completeBaseName()
+                                                    + QLatin1String(".queue"))));
 
+#ifndef QAMPLITUDEANALYTICS_NO_PERSISTENCE
+    // Move events queued by older versions to the event queue. Without
+    // persistence they are left in the settings, instead of being lost.
     int size = m_settings->beginReadArray(QLatin1String("QueuedEvents"));
     for (int i = 0; i < size; ++i) {
         m_settings->setArrayIndex(i);
-        m_queue.append(m_settings->value(QLatin1String("Event")).toString());
+        m_eventQueue->append(m_settings->value(QLatin1String("Event")).toString().toUtf8());
     }
     m_settings->endArray();
+    if (size > 0) {
+        m_eventQueue->flush(true);
+        m_settings->remove(QLatin1String("QueuedEvents"));
+        m_settings->sync();
+    }
+#endif
+
+    // Primary destination uses the default reader of the event queue
+    Destination primary;
+    primary.apiKey = m_apiKey;
+    primary.url = QUrl(QLatin1String(DefaultUrl));
+    primary.batchController = QSharedPointer<QAmplitudeBatchController>(
+                new QAmplitudeBatchController());
+    m_destinations.append(primary);
+
+    m_persistTimer->setInterval(m_persistInterval);
+    connect(m_persistTimer, SIGNAL(timeout()), this, SLOT(persistQueuedEvents()));
+    m_clock.start();
+    m_requestTimer->setInterval(1000);
+    connect(m_requestTimer, SIGNAL(timeout()), this, SLOT(onRequestTimer()));
+    if (QCoreApplication::instance()) {
+        connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()),
+                this, SLOT(persistQueuedEvents()));
+        // For ApplicationActivate and ApplicationDeactivate. Not
+        // possible when used from another thread.
+        if (thread() == QCoreApplication::instance()->thread())
+            QCoreApplication::instance()->installEventFilter(this);
+    }
 
     connect(m_nam.data(), SIGNAL(finished(QNetworkReply*)), this, SLOT(onNetworkReply(QNetworkReply*)));
 }
@@ -266,9 +416,25 @@ void QAmplitudeAnalytics::setApiKey(const QString &apiKey)
         return;
 
     m_apiKey = apiKey;
+    m_destinations[0].apiKey = apiKey;
     emit apiKeyChanged();
 }
 
+QUrl QAmplitudeAnalytics::serverUrl() const
+{
+    return m_destinations.at(0).url;
+}
+
+void QAmplitudeAnalytics::setServerUrl(const QUrl &url)
+{
+    const QUrl serverUrl = url.isEmpty() ? QUrl(QLatin1String(DefaultUrl)) : url;
+    if (m_destinations.at(0).url == serverUrl)
+        return;
+
+    m_destinations[0].url = serverUrl;
+    emit serverUrlChanged();
+}
+
 QString QAmplitudeAnalytics::appVersion() const
 {
     return m_appVersion;
@@ -294,6 +460,10 @@ void QAmplitudeAnalytics::setUserId(const QString &id)
         return;
 
     m_userId = id;
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    // Properties sent so far belong to the previous user
+    resetSentUserProperties();
+#endif
     emit userId();
 }
 
@@ -308,9 +478,30 @@ void QAmplitudeAnalytics::setPersistentUserProperties(const QVariantMap &propert
         return;
 
     m_userProperties = properties;
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    m_userPropertiesChanged = true;
+#endif
     emit persistentUserPropertiesChanged();
 }
 
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+bool QAmplitudeAnalytics::isUserPropertiesDeltaEnabled() const
+{
+    return m_userPropertiesDeltaEnabled;
+}
+
+void QAmplitudeAnalytics::setUserPropertiesDeltaEnabled(bool enabled)
+{
+    if (m_userPropertiesDeltaEnabled == enabled)
+        return;
+
+    m_userPropertiesDeltaEnabled = enabled;
+    // Compare with what was sent before on the next event
+    m_userPropertiesChanged = true;
+    emit userPropertiesDeltaEnabledChanged();
+}
+#endif
+
 QAmplitudeAnalytics::DeviceInfo QAmplitudeAnalytics::deviceInfo() const
 {
     return m_device;
@@ -325,6 +516,7 @@ void QAmplitudeAnalytics::setDeviceInfo(const DeviceInfo &info)
     emit deviceInfoChanged();
 }
 
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
 QAmplitudeAnalytics::LocationInfo QAmplitudeAnalytics::locationInfo() const
 {
     return m_location;
@@ -338,6 +530,7 @@ void QAmplitudeAnalytics::setLocationInfo(const LocationInfo &info)
     m_location = info;
     emit locationInfoChanged();
 }
+#endif
 
 QString QAmplitudeAnalytics::language() const
 {
@@ -367,14 +560,246 @@ void QAmplitudeAnalytics::setPrivacyEnabled(bool enabled)
     emit privacyEnabledChanged();
 }
 
-QAmplitudeAnalytics::~QAmplitudeAnalytics()
+int QAmplitudeAnalytics::sessionTimeout() const
+{
+    return m_sessionTimeout;
+}
+
+void QAmplitudeAnalytics::setSessionTimeout(int msecs)
+{
+    if (msecs <= 0 || m_sessionTimeout == msecs)
+        return;
+
+    m_sessionTimeout = msecs;
+    emit sessionTimeoutChanged();
+}
+
+bool QAmplitudeAnalytics::isSessionEventsEnabled() const
+{
+    return m_sessionEventsEnabled;
+}
+
+void QAmplitudeAnalytics::setSessionEventsEnabled(bool enabled)
+{
+    if (m_sessionEventsEnabled == enabled)
+        return;
+
+    m_sessionEventsEnabled = enabled;
+    emit sessionEventsEnabledChanged();
+}
+
+QAmplitudeAnalytics::PersistenceMode QAmplitudeAnalytics::persistenceMode() const
+{
+    return m_persistenceMode;
+}
+
+void QAmplitudeAnalytics::setPersistenceMode(PersistenceMode mode)
+{
+    if (m_persistenceMode == mode)
+        return;
+
+    m_persistenceMode = mode;
+    if (m_persistenceMode == PersistPeriodically)
+        m_persistTimer->start();
+    else
+        m_persistTimer->stop();
+
+    // Don't leave changes from the previous mode unsaved
+    // for longer than the new mode allows
+    if (m_persistenceMode == PersistImmediately)
+        persistQueuedEvents();
+
+    emit persistenceModeChanged();
+}
+
+int QAmplitudeAnalytics::persistInterval() const
+{
+    return m_persistInterval;
+}
+
+void QAmplitudeAnalytics::setPersistInterval(int msecs)
 {
-    if (m_reply) {
-        m_reply->abort();
-        m_reply->deleteLater();
+    if (msecs <= 0 || m_persistInterval == msecs)
+        return;
+
+    m_persistInterval = msecs;
+    m_persistTimer->setInterval(m_persistInterval);
+    emit persistIntervalChanged();
+}
+
+int QAmplitudeAnalytics::persistEventThreshold() const
+{
+    return m_persistEventThreshold;
+}
+
+void QAmplitudeAnalytics::setPersistEventThreshold(int count)
+{
+    if (count <= 0 || m_persistEventThreshold == count)
+        return;
+
+    m_persistEventThreshold = count;
+    emit persistEventThresholdChanged();
+}
+
+bool QAmplitudeAnalytics::isQueueCompressionEnabled() const
+{
+    return m_eventQueue->isCompressionEnabled();
+}
+
+void QAmplitudeAnalytics::setQueueCompressionEnabled(bool enabled)
+{
+    if (m_eventQueue->isCompressionEnabled() == enabled)
+        return;
+
+    m_eventQueue->setCompressionEnabled(enabled);
+    emit queueCompressionEnabledChanged();
+}
+
+QAmplitudeAnalytics::UploadPolicy QAmplitudeAnalytics::uploadPolicy() const
+{
+    return m_uploadPolicy;
+}
+
+void QAmplitudeAnalytics::setUploadPolicy(UploadPolicy policy)
+{
+    if (m_uploadPolicy == policy)
+        return;
+
+    m_uploadPolicy = policy;
+    if (m_uploadPolicy != UploadAlways)
+        watchNetwork();
+    resumeUploads();
+    emit uploadPolicyChanged();
+}
+
+QAmplitudeAnalytics::NetworkState QAmplitudeAnalytics::networkState() const
+{
+    if (m_networkStateOverride != NetworkStateUnknown)
+        return m_networkStateOverride;
+    return m_detectedNetworkState;
+}
+
+QAmplitudeAnalytics::NetworkState QAmplitudeAnalytics::networkStateOverride() const
+{
+    return m_networkStateOverride;
+}
+
+void QAmplitudeAnalytics::setNetworkStateOverride(NetworkState state)
+{
+    if (m_networkStateOverride == state)
+        return;
+
+    m_networkStateOverride = state;
+    resumeUploads();
+    emit networkStateChanged();
+}
+
+void QAmplitudeAnalytics::addDestination(const QString &apiKey, const QUrl &url)
+{
+    Destination destination;
+    destination.apiKey = apiKey;
+    destination.url = url.isEmpty() ? QUrl(QLatin1String(DefaultUrl)) : url;
+    foreach (const Destination &existing, m_destinations) {
+        if (existing.apiKey == destination.apiKey && existing.url == destination.url)
+            return;
+    }
+
+    destination.reader = QString::fromLatin1(
+                QCryptographicHash::hash((apiKey + QLatin1Char(' ') + destination.url.toString())
+                                         .toUtf8(), QCryptographicHash::Sha1).toHex().left(16));
+    destination.batchController = QSharedPointer<QAmplitudeBatchController>(
+                new QAmplitudeBatchController());
+    const bool added = !m_eventQueue->readers().contains(destination.reader);
+    m_eventQueue->addReader(destination.reader);
+    m_destinations.append(destination);
+
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    // Only changes are sent, so the new destination doesn't have
+    // the user properties that were sent to the others before
+    if (added && !m_sentUserProperties.isEmpty()) {
+        if (m_userPropertiesDeltaEnabled)
+            queueSetUserProperties(m_sentUserProperties, m_eventClock->currentMSecsSinceEpoch());
+        else
+            resetSentUserProperties();
     }
+#else
+    Q_UNUSED(added)
+#endif
+}
 
-    saveToSettings();
+void QAmplitudeAnalytics::removeDestination(const QString &apiKey, const QUrl &url)
+{
+    const QUrl destinationUrl = url.isEmpty() ? QUrl(QLatin1String(DefaultUrl)) : url;
+    // Primary destination can't be removed
+    for (int i = 1; i < m_destinations.count(); ++i) {
+        const Destination destination = m_destinations.at(i);
+        if (destination.apiKey != apiKey || destination.url != destinationUrl)
+            continue;
+
+        abortRequests(m_destinations[i]);
+        m_eventQueue->removeReader(m_destinations.at(i).reader);
+        m_destinations.removeAt(i);
+        return;
+    }
+}
+
+void QAmplitudeAnalytics::removeStaleDestinations()
+{
+    foreach (const QString &reader, m_eventQueue->readers()) {
+        bool used = false;
+        foreach (const Destination &destination, m_destinations)
+            used = used || destination.reader == reader;
+        if (!used)
+            m_eventQueue->removeReader(reader);
+    }
+}
+
+#ifndef QAMPLITUDEANALYTICS_NO_METRICS
+QVariantMap QAmplitudeAnalytics::metrics() const
+{
+    QVariantMap metrics;
+    int inFlight = 0;
+    QVariantList destinations;
+    foreach (const Destination &destination, m_destinations) {
+        const QAmplitudeBatchController *controller = destination.batchController.data();
+        inFlight += destination.batches.count();
+        QVariantMap values;
+        values.insert(QLatin1String("apiKey"), destination.apiKey);
+        values.insert(QLatin1String("url"), destination.url);
+        values.insert(QLatin1String("queuedEvents"),
+                      m_eventQueue->count(destination.reader) + m_queue.count());
+        values.insert(QLatin1String("requestsInFlight"), destination.batches.count());
+        values.insert(QLatin1String("maxRequestsInFlight"), controller->maxInFlight());
+        values.insert(QLatin1String("batchBytes"), controller->batchBytes());
+        values.insert(QLatin1String("roundTripTime"), controller->roundTripTime());
+        values.insert(QLatin1String("uploadBandwidth"), controller->bandwidth());
+        values.insert(QLatin1String("errorRate"), controller->errorRate());
+        values.insert(QLatin1String("requestTimeout"), controller->requestTimeout());
+        destinations.append(values);
+    }
+    metrics.insert(QLatin1String("destinations"), destinations);
+    metrics.insert(QLatin1String("queueBytes"), m_eventQueue->size());
+    metrics.insert(QLatin1String("queueStoredBytes"), m_eventQueue->storedSize());
+    if (m_eventQueue->storedSize() > 0) {
+        metrics.insert(QLatin1String("queueCompressionRatio"),
+                       qreal(m_eventQueue->size()) / m_eventQueue->storedSize());
+    }
+    metrics.insert(QLatin1String("requestsInFlight"), inFlight);
+    metrics.insert(QLatin1String("rejectedEvents"), m_rejectedEvents);
+    metrics.insert(QLatin1String("networkState"), int(networkState()));
+    return metrics;
+}
+#endif
+
+QAmplitudeAnalytics::~QAmplitudeAnalytics()
+{
+    // Events of aborted requests stay in the event
+    // queue and will be sent again on the next start
+    for (int i = 0; i < m_destinations.count(); ++i)
+        abortRequests(m_destinations[i]);
+
+    persistQueuedEvents();
+    saveSession();
     m_settings->endGroup();
 }
 
@@ -391,12 +816,29 @@ void QAmplitudeAnalytics::trackEvent(const QString &eventType,
                                      const QVariant &revenue,
                                      bool postpone)
 {
+    const qint64 time = m_eventClock->currentMSecsSinceEpoch();
+    updateSession(time);
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    if (m_userPropertiesDeltaEnabled) {
+        if (!userProperties.isEmpty()) {
+            queueUserPropertyChanges(userProperties, time);
+        } else if (m_userPropertiesChanged) {
+            m_userPropertiesChanged = false;
+            queueUserPropertyChanges(m_userProperties, time);
+        }
+    }
+#endif
+
     QVariantHash event;
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    fillCommonProperties(event, m_userPropertiesDeltaEnabled ? QVariantMap() : userProperties);
+#else
     fillCommonProperties(event, userProperties);
+#endif
     event.insert(QLatin1String("event_type"), eventType);
-    event.insert(QLatin1String("time"), QDateTime::currentDateTimeUtc().toMSecsSinceEpoch());
     event.insert(QLatin1String("event_properties"), eventProperties);
 
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     if (!m_privacyEnabled) {
         if (m_location.latitude.isValid())
             event.insert(QLatin1String("location_lat"), doubleToString(m_location.latitude, 15));
@@ -405,19 +847,13 @@ void QAmplitudeAnalytics::trackEvent(const QString &eventType,
         if (!m_location.ip.isEmpty())
             event.insert(QLatin1String("ip"), m_location.ip);
     }
+#endif
 
     if (revenue.isValid()) {
         event.insert(QLatin1String("revenue"), doubleToString(revenue, 2));
     }
 
-    event.insert(QLatin1String("event_id"), ++m_lastEventId);
-    event.insert(QLatin1String("session_id"), m_sessionId);
-    QString uuid = QUuid::createUuid().toString();
-    // Strip curly braces
-    uuid.remove(0, 1).chop(1);
-    event.insert(QLatin1String("insert_id"), uuid);
-    m_queue.append(toJson(event));
-    saveToSettings();
+    queueEvent(event, time);
 
     if (postpone) {
         return;
@@ -426,6 +862,7 @@ void QAmplitudeAnalytics::trackEvent(const QString &eventType,
     sendQueuedEvents();
 }
 
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
 void QAmplitudeAnalytics::identifyUser(const QVariantMap &userProperties,
                                        const QVariant paying,
                                        const QString &startVersion)
@@ -438,94 +875,496 @@ void QAmplitudeAnalytics::identifyUser(const QVariantMap &userProperties,
     if (!startVersion.isEmpty())
         identification.insert(QLatin1String("start_version"), startVersion);
 
+    const QString json = toJson(identification);
+    foreach (const Destination &destination, m_destinations) {
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
-    QUrl query;
+        QUrl query;
 #else
-    QUrlQuery query;
+        QUrlQuery query;
 #endif
-    query.addQueryItem(QLatin1String("api_key"), m_apiKey);
-    query.addQueryItem(QLatin1String("identification"), toJson(identification));
-
-    QNetworkRequest request(QUrl(QLatin1String("https://api.amplitude.com/identify")));
-    request.setSslConfiguration(m_sslConfiguration);
-    request.setHeader(QNetworkRequest::ContentTypeHeader,
-                      QLatin1String("application/x-www-form-urlencoded;charset=UTF-8"));
+        query.addQueryItem(QLatin1String("api_key"), destination.apiKey);
+        query.addQueryItem(QLatin1String("identification"), json);
+
+        // Identify endpoint lives next to the event one
+        QNetworkRequest request(destination.url.resolved(QUrl(QLatin1String("identify"))));
+        request.setSslConfiguration(m_sslConfiguration);
+        request.setHeader(QNetworkRequest::ContentTypeHeader,
+                          QLatin1String("application/x-www-form-urlencoded;charset=UTF-8"));
 #if QT_VERSION < QT_VERSION_CHECK(5,0,0)
-    const QByteArray data(query.encodedQuery());
+        const QByteArray data(query.encodedQuery());
 #else
-    const QByteArray data(query.toString(QUrl::FullyEncoded).toUtf8());
+        const QByteArray data(query.toString(QUrl::FullyEncoded).toUtf8());
 #endif
-    m_nam->post(request, data);
+        m_nam->post(request, data);
+    }
 }
+#endif
 
 void QAmplitudeAnalytics::sendQueuedEvents()
 {
-    if (m_queue.isEmpty())
+    if (m_queue.isEmpty() && m_eventQueue->isEmpty())
         return;
 
-    if (m_reply || !m_pending.isEmpty()) {
-        // We already have request pending - mark that we
-        // should send again and wait until it finishes
-        m_shouldSend = true;
-        return;
-    }
+    for (int i = 0; i < m_destinations.count(); ++i)
+        sendQueuedEvents(m_destinations[i]);
+}
 
-    m_shouldSend = false;
-    m_pending = m_queue;
+void QAmplitudeAnalytics::clearQueuedEvents()
+{
+    for (int i = 0; i < m_destinations.count(); ++i)
+        m_destinations[i].shouldSend = false;
     m_queue.clear();
-
-#if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
-    QUrl query;
-#else
-    QUrlQuery query;
+    m_queueBytes = 0;
+    m_eventQueue->clear();
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    // Cleared events might have included $identify ones
+    resetSentUserProperties();
 #endif
-    query.addQueryItem(QLatin1String("api_key"), m_apiKey);
-    query.addQueryItem(QLatin1String("event"), m_pending.join(QLatin1String(","))
-                                                        .prepend(QLatin1Char('['))
-                                                        .append(QLatin1Char(']')));
+    queueChanged();
+}
 
-    QNetworkRequest request(QUrl(QLatin1String("https://api.amplitude.com/httpapi")));
-    request.setSslConfiguration(m_sslConfiguration);
-    request.setHeader(QNetworkRequest::ContentTypeHeader,
-                      QLatin1String("application/x-www-form-urlencoded;charset=UTF-8"));
-#if QT_VERSION < QT_VERSION_CHECK(5,0,0)
-    const QByteArray data(query.encodedQuery());
-#else
-    const QByteArray data(query.toString(QUrl::FullyEncoded).toUtf8());
+void QAmplitudeAnalytics::persistQueuedEvents()
+{
+    if (m_unsavedChanges == 0)
+        return;
+
+    m_unsavedChanges = 0;
+    writeQueuedEvents();
+    m_eventQueue->flush(true);
+
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    // Only after the $identify events are stored
+    if (m_sentUserPropertiesChanged) {
+        m_sentUserPropertiesChanged = false;
+        m_settings->setValue(QLatin1String("SentUserProperties"), m_sentUserProperties);
+    }
 #endif
-    m_reply = m_nam->post(request, data);
 }
 
-void QAmplitudeAnalytics::clearQueuedEvents()
+void QAmplitudeAnalytics::notifyNetworkActivity()
 {
-    m_shouldSend = false;
-    m_queue.clear();
+    m_networkActivity.start();
+    resumeUploads();
+}
+
+bool QAmplitudeAnalytics::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == QCoreApplication::instance()) {
+        if (event->type() == QEvent::ApplicationActivate) {
+            // The device might have been suspended. Whether the session
+            // continues is decided by the next tracked event.
+            m_eventClock->synchronize();
+        } else if (event->type() == QEvent::ApplicationDeactivate) {
+            // The session times out counting from now, the
+            // application might not get a chance to save later
+            if (m_sessionId >= 0)
+                m_lastEventTime = m_eventClock->currentMSecsSinceEpoch();
+            persistQueuedEvents();
+            saveSession();
+        }
+    }
+    return QObject::eventFilter(watched, event);
 }
 
 void QAmplitudeAnalytics::onNetworkReply(QNetworkReply *reply)
 {
-    if (reply != m_reply) {
-        // Reply not for the current request - ignore it (we
-        // shouldn't have two requests running in parallel)
+    int i = 0;
+    int j = 0;
+    for (; i < m_destinations.count(); ++i) {
+        const QList<Batch> &batches = m_destinations.at(i).batches;
+        j = 0;
+        while (j < batches.count() && batches.at(j).reply != reply)
+            ++j;
+        if (j < batches.count())
+            break;
+    }
+    if (i == m_destinations.count()) {
+        // Reply not for a current request (e.g. identification or
+        // an aborted request) - ignore it
         reply->deleteLater();
         return;
     }
-    m_reply = NULL;
 
-    if (reply->error() != QNetworkReply::NoError) {
-        // Sending failed - return pending events back to the queue
-        m_pending.append(m_queue);
-        m_queue = m_pending;
+    Destination &destination = m_destinations[i];
+    Batch &batch = destination.batches[j];
+    batch.reply = NULL;
+
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply->error() == QNetworkReply::NoError) {
+        destination.batchController->succeeded(batch.bytes, batch.timer.elapsed());
+        // Keeps the radio active for piggybacking
+        m_networkActivity.start();
+        destination.backoff = 0;
+        batch.done = true;
+        commitBatches(destination);
+        // Large queues are sent in several batches
+        if (!m_eventQueue->isEmpty(destination.reader))
+            destination.shouldSend = true;
+    } else if (status == 429 || status == 503) {
+        // Throttled - wait for as long as the server asks to
+        destination.batchController->failed();
+        destination.backoff = qBound(MinBackoff, destination.backoff * 2, MaxBackoff);
+        const qint64 delay = retryAfter(reply);
+        pause(destination, delay >= 0 ? delay : destination.backoff);
+        abandonBatches(destination, j);
+    } else if (status == 413 && batch.end - batch.begin > 1) {
+        // Too large - sent again right away in smaller batches
+        destination.batchController->failed();
+        abandonBatches(destination, j);
+        destination.shouldSend = true;
+    } else if (status == 400 || status == 413) {
+        // Events the server names as invalid are dropped. Otherwise,
+        // e.g. with an invalid API key, they are kept until it's fixed.
+        const QByteArray response = reply->readAll();
+        if (!rejectEvents(destination, j, response)) {
+            qWarning() << "Request rejected:" << response;
+            if (status == 413)
+                destination.batchController->failed();
+            destination.backoff = qBound(MinBackoff, destination.backoff * 2, MaxBackoff);
+            pause(destination, destination.backoff);
+            abandonBatches(destination, j);
+        }
+    } else {
+        // Sending failed - leave events in the queue
+        destination.batchController->failed();
         qWarning() << reply->errorString();
+        abandonBatches(destination, j);
     }
-    m_pending.clear();
     reply->deleteLater();
 
-    saveToSettings();
+    if (destination.shouldSend) {
+        sendQueuedEvents(destination);
+    }
+}
+
+void QAmplitudeAnalytics::onRequestTimer()
+{
+    QList<QNetworkReply *> expired;
+    QList<int> resumed;
+    bool active = false;
+    for (int i = 0; i < m_destinations.count(); ++i) {
+        Destination &destination = m_destinations[i];
+        if (destination.pausedUntil > requestClock()) {
+            active = true;
+        } else if (destination.pausedUntil > 0) {
+            destination.pausedUntil = 0;
+            if (destination.shouldSend)
+                resumed.append(i);
+        }
 
-    if (m_shouldSend) {
-        sendQueuedEvents();
+        foreach (const Batch &batch, destination.batches) {
+            if (!batch.reply)
+                continue;
+            active = true;
+            if (batch.timer.elapsed() > destination.batchController->requestTimeout())
+                expired.append(batch.reply);
+        }
     }
+    if (!active)
+        m_requestTimer->stop();
+
+    // Handled by onNetworkReply() as failed requests
+    foreach (QNetworkReply *reply, expired)
+        reply->abort();
+
+    foreach (int i, resumed)
+        sendQueuedEvents(m_destinations[i]);
+}
+
+void QAmplitudeAnalytics::onNetworkChanged()
+{
+    const NetworkState state = detectNetworkState();
+    if (m_detectedNetworkState == state)
+        return;
+
+    m_detectedNetworkState = state;
+    if (m_networkStateOverride != NetworkStateUnknown)
+        return;
+
+    resumeUploads();
+    emit networkStateChanged();
+}
+
+void QAmplitudeAnalytics::sendQueuedEvents(Destination &destination)
+{
+    // Events are sent from the event queue, which keeps track of what
+    // has been sent. Write them out, but leave syncing to persistQueuedEvents()
+    writeQueuedEvents();
+    m_eventQueue->flush(false);
+
+    if (m_eventQueue->isEmpty(destination.reader))
+        return;
+
+    if (destination.pausedUntil > 0) {
+        // Paused after a server error - resumed by onRequestTimer()
+        destination.shouldSend = true;
+        return;
+    }
+
+    if (!isUploadAllowed()) {
+        // Resumed when the network state changes
+        // or on notifyNetworkActivity()
+        destination.shouldSend = true;
+        return;
+    }
+
+    if (destination.batches.count() >= destination.batchController->maxInFlight()) {
+        // Enough requests are pending - mark that we should
+        // send again and wait until one of them finishes
+        destination.shouldSend = true;
+        return;
+    }
+
+    destination.shouldSend = false;
+    while (destination.batches.count() < destination.batchController->maxInFlight()) {
+        // Events point into memory mapped segments of the event queue and
+        // are encoded straight into the request body, without other copies
+        Batch batch;
+        const QList<QByteArray> events = m_eventQueue->read(
+                    destination.reader, MaxBatchEvents,
+                    destination.batchController->batchBytes(), &batch.end);
+        if (events.isEmpty()) {
+            // Nothing (readable) was left
+            if (destination.batches.isEmpty())
+                m_eventQueue->commit(destination.reader, batch.end);
+            break;
+        }
+        batch.begin = batch.end - events.count();
+
+        QList<QByteArray> accepted;
+        for (int i = 0; i < events.count(); ++i) {
+            if (destination.rejected.contains(batch.begin + i))
+                continue;
+            accepted.append(events.at(i));
+            batch.bytes += events.at(i).size();
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+            if (events.at(i).contains("\"$identify\""))
+                batch.identifies.insert(batch.begin + i, QByteArray(events.at(i).constData(),
+                                                                    events.at(i).size()));
+#endif
+        }
+        if (accepted.isEmpty()) {
+            // Only rejected events - nothing to send
+            batch.done = true;
+            destination.batches.append(batch);
+            commitBatches(destination);
+            continue;
+        }
+
+        QByteArray data;
+        // Most characters of JSON don't need encoding, but quotes and commas do
+        data.reserve(int(batch.bytes + batch.bytes / 4) + 64);
+        data.append("api_key=").append(QUrl::toPercentEncoding(destination.apiKey));
+        data.append("&event=%5B");
+        for (int i = 0; i < accepted.count(); ++i) {
+            if (i > 0)
+                data.append("%2C");
+            data.append(accepted.at(i).toPercentEncoding());
+        }
+        data.append("%5D");
+
+        QNetworkRequest request(destination.url);
+        request.setSslConfiguration(m_sslConfiguration);
+        request.setHeader(QNetworkRequest::ContentTypeHeader,
+                          QLatin1String("application/x-www-form-urlencoded;charset=UTF-8"));
+        batch.timer.start();
+        batch.reply = m_nam->post(request, data);
+        destination.batches.append(batch);
+    }
+
+    if (!m_requestTimer->isActive())
+        m_requestTimer->start();
+}
+
+void QAmplitudeAnalytics::abortRequests(Destination &destination)
+{
+    // Removed first, so that onNetworkReply() ignores them
+    const QList<Batch> batches = destination.batches;
+    destination.batches.clear();
+    m_eventQueue->rewind(destination.reader);
+    foreach (const Batch &batch, batches) {
+        if (batch.reply) {
+            batch.reply->abort();
+            batch.reply->deleteLater();
+        }
+    }
+}
+
+void QAmplitudeAnalytics::commitBatches(Destination &destination)
+{
+    // The queue is committed in order, up to the first unfinished batch
+    bool committed = false;
+    while (!destination.batches.isEmpty() && destination.batches.first().done) {
+        const qint64 end = destination.batches.takeFirst().end;
+        m_eventQueue->commit(destination.reader, end);
+        committed = true;
+
+        QSet<qint64>::iterator it = destination.rejected.begin();
+        while (it != destination.rejected.end()) {
+            if (*it < end)
+                it = destination.rejected.erase(it);
+            else
+                ++it;
+        }
+    }
+    if (committed)
+        queueChanged();
+}
+
+void QAmplitudeAnalytics::abandonBatches(Destination &destination, int first)
+{
+    // Events of the batch and of all batches read after it are read
+    // again, as the queue is committed in order
+    const qint64 end = first > 0 ? destination.batches.at(first - 1).end : -1;
+    const QList<Batch> abandoned = destination.batches.mid(first + 1);
+    destination.batches.erase(destination.batches.begin() + first, destination.batches.end());
+    m_eventQueue->rewind(destination.reader, end);
+    foreach (const Batch &batch, abandoned) {
+        if (batch.reply) {
+            batch.reply->abort();
+            batch.reply->deleteLater();
+        }
+    }
+}
+
+bool QAmplitudeAnalytics::rejectEvents(Destination &destination, int batch,
+                                       const QByteArray &response)
+{
+    // Queue indexes of events in the order they were sent
+    const Batch &failed = destination.batches.at(batch);
+    QList<qint64> sent;
+    for (qint64 index = failed.begin; index < failed.end; ++index) {
+        if (!destination.rejected.contains(index))
+            sent.append(index);
+    }
+
+    QList<int> indexes;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    indexes = rejectedEventIndexes(response);
+#endif
+
+    int dropped = 0;
+    foreach (int index, indexes) {
+        if (index < sent.count() && !destination.rejected.contains(sent.at(index))) {
+            destination.rejected.insert(sent.at(index));
+            ++dropped;
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+            if (failed.identifies.contains(sent.at(index)))
+                forgetSentUserProperties(failed.identifies.value(sent.at(index)));
+#endif
+        }
+    }
+    if (dropped == 0)
+        return false;
+
+    qWarning() << "Events rejected:" << response;
+#ifndef QAMPLITUDEANALYTICS_NO_METRICS
+    m_rejectedEvents += dropped;
+#endif
+
+    // The rest of the batch is sent again right away
+    abandonBatches(destination, batch);
+    destination.shouldSend = true;
+    return true;
+}
+
+void QAmplitudeAnalytics::pause(Destination &destination, qint64 msecs)
+{
+    qWarning() << "Pausing requests for" << msecs << "ms";
+    // Not 0, which means not paused
+    destination.pausedUntil = qMax(Q_INT64_C(1), requestClock() + msecs);
+    destination.shouldSend = true;
+    if (!m_requestTimer->isActive())
+        m_requestTimer->start();
+}
+
+qint64 QAmplitudeAnalytics::requestClock() const
+{
+#ifdef QAMPLITUDEANALYTICS_TESTING
+    return m_clock.elapsed() + qamplitudeanalytics_requestClockSkew;
+#else
+    return m_clock.elapsed();
+#endif
+}
+
+bool QAmplitudeAnalytics::isUploadAllowed() const
+{
+    const NetworkState state = networkState();
+    switch (m_uploadPolicy) {
+    case UploadAlways:
+        return true;
+    case UploadWhenOnline:
+        return state != NetworkOffline;
+    case UploadOnUnmeteredNetwork:
+        return state == NetworkUnmetered || state == NetworkStateUnknown;
+    case UploadPiggyback:
+        if (state == NetworkMetered)
+            return m_networkActivity.isValid() && m_networkActivity.elapsed() < PiggybackWindow;
+        return state != NetworkOffline;
+    }
+    return true;
+}
+
+void QAmplitudeAnalytics::resumeUploads()
+{
+    for (int i = 0; i < m_destinations.count(); ++i) {
+        if (m_destinations.at(i).shouldSend)
+            sendQueuedEvents(m_destinations[i]);
+    }
+}
+
+void QAmplitudeAnalytics::watchNetwork()
+{
+#ifdef QAMPLITUDEANALYTICS_BEARER_MANAGEMENT
+    // Created on demand, as it enumerates network interfaces
+    if (m_networkManager)
+        return;
+
+    m_networkManager = new QNetworkConfigurationManager(this);
+    connect(m_networkManager, SIGNAL(onlineStateChanged(bool)), this, SLOT(onNetworkChanged()));
+    connect(m_networkManager, SIGNAL(configurationChanged(QNetworkConfiguration)),
+            this, SLOT(onNetworkChanged()));
+    m_detectedNetworkState = detectNetworkState();
+    if (m_detectedNetworkState != NetworkStateUnknown
+            && m_networkStateOverride == NetworkStateUnknown) {
+        emit networkStateChanged();
+    }
+#endif
+}
+
+QAmplitudeAnalytics::NetworkState QAmplitudeAnalytics::detectNetworkState() const
+{
+#ifdef QAMPLITUDEANALYTICS_BEARER_MANAGEMENT
+    // Without bearer plugins there are no configurations
+    if (!m_networkManager || m_networkManager->allConfigurations().isEmpty())
+        return NetworkStateUnknown;
+    if (!m_networkManager->isOnline())
+        return NetworkOffline;
+
+    NetworkState state = NetworkMetered;
+    foreach (const QNetworkConfiguration &configuration,
+             m_networkManager->allConfigurations(QNetworkConfiguration::Active)) {
+#if QT_VERSION < QT_VERSION_CHECK(4, 8, 0)
+        const QString bearer = configuration.bearerName();
+        if (bearer == QLatin1String("WLAN") || bearer == QLatin1String("Ethernet"))
+            return NetworkUnmetered;
+#else
+        switch (configuration.bearerType()) {
+        case QNetworkConfiguration::BearerWLAN:
+        case QNetworkConfiguration::BearerEthernet:
+            return NetworkUnmetered;
+        case QNetworkConfiguration::BearerUnknown:
+            state = NetworkStateUnknown;
+            break;
+        default:
+            break;
+        }
+#endif
+    }
+    return state;
+#else
+    return NetworkStateUnknown;
+#endif
 }
 
 void QAmplitudeAnalytics::fillCommonProperties(QVariantHash &hashMap,
@@ -536,10 +1375,15 @@ void QAmplitudeAnalytics::fillCommonProperties(QVariantHash &hashMap,
     if (!m_device.id.isEmpty())
         hashMap.insert(QLatin1String("device_id"), m_device.id);
 
-    if (!userProperties.isEmpty())
+    if (!userProperties.isEmpty()) {
         hashMap.insert(QLatin1String("user_properties"), userProperties);
-    else if (!m_userProperties.isEmpty())
-        hashMap.insert(QLatin1String("user_properties"), m_userProperties);
+    } else if (!m_userProperties.isEmpty()) {
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+        // Sent in $identify events instead
+        if (!m_userPropertiesDeltaEnabled)
+#endif
+            hashMap.insert(QLatin1String("user_properties"), m_userProperties);
+    }
 
     if (!m_appVersion.isEmpty())
         hashMap.insert(QLatin1String("app_version"), m_appVersion);
@@ -559,6 +1403,7 @@ void QAmplitudeAnalytics::fillCommonProperties(QVariantHash &hashMap,
     if (!m_privacyEnabled) {
         if (!m_device.carrier.isEmpty())
             hashMap.insert(QLatin1String("carrier"), m_device.carrier);
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
         if (!m_location.country.isEmpty())
             hashMap.insert(QLatin1String("country"), m_location.country);
         if (!m_location.region.isEmpty())
@@ -567,21 +1412,148 @@ void QAmplitudeAnalytics::fillCommonProperties(QVariantHash &hashMap,
             hashMap.insert(QLatin1String("city"), m_location.city);
         if (!m_location.dma.isEmpty())
             hashMap.insert(QLatin1String("dma"), m_location.dma);
+#endif
         if (!m_language.isEmpty())
             hashMap.insert(QLatin1String("language"), m_language);
     }
 }
 
-void QAmplitudeAnalytics::saveToSettings()
+void QAmplitudeAnalytics::queueEvent(QVariantHash &event, qint64 time)
 {
-    if (!m_queue.isEmpty()) {
-        m_settings->beginWriteArray(QLatin1String("QueuedEvents"));
-        for (int i = 0; i < m_queue.count(); ++i) {
-            m_settings->setArrayIndex(i);
-            m_settings->setValue(QLatin1String("Event"), m_queue.at(i));
-        }
-        m_settings->endArray();
-    } else {
-        m_settings->remove(QLatin1String("QueuedEvents"));
+    if (++m_lastEventId > m_reservedEventId) {
+        // Saving every id would be too slow. After a restart,
+        // ids continue after the reserved ones instead.
+        m_reservedEventId = m_lastEventId + EventIdBlock - 1;
+        m_settings->setValue(QLatin1String("LastEventId"), m_reservedEventId);
+        saveSession();
+        m_settings->sync();
+    }
+
+    event.insert(QLatin1String("time"), time);
+    event.insert(QLatin1String("event_id"), m_lastEventId);
+    event.insert(QLatin1String("session_id"), m_sessionId);
+    event.insert(QLatin1String("insert_id"), m_idGenerator->createUuid());
+    m_queue.append(toJson(event).toUtf8());
+    m_queueBytes += m_queue.last().size();
+    if (m_queue.count() >= MaxBufferedEvents || m_queueBytes >= MaxBufferedBytes) {
+        // Written out, but synced according to the persistence mode
+        writeQueuedEvents();
+        m_eventQueue->flush(false);
     }
+    queueChanged();
+}
+
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+void QAmplitudeAnalytics::queueUserPropertyChanges(const QVariantMap &userProperties,
+                                                   qint64 time)
+{
+    QVariantMap changes;
+    for (QVariantMap::const_iterator it = userProperties.constBegin();
+         it != userProperties.constEnd(); ++it) {
+        QVariantMap::const_iterator sent = m_sentUserProperties.constFind(it.key());
+        if (sent == m_sentUserProperties.constEnd() || sent.value() != it.value())
+            changes.insert(it.key(), it.value());
+    }
+    if (!changes.isEmpty())
+        queueSetUserProperties(changes, time);
+}
+
+void QAmplitudeAnalytics::queueSetUserProperties(const QVariantMap &userProperties, qint64 time)
+{
+    QVariantMap operations;
+    operations.insert(QLatin1String("$set"), userProperties);
+    QVariantHash identify;
+    fillCommonProperties(identify, QVariantMap());
+    identify.insert(QLatin1String("event_type"), QLatin1String("$identify"));
+    identify.insert(QLatin1String("user_properties"), operations);
+    queueEvent(identify, time);
+
+    // A copy, userProperties may be m_sentUserProperties itself
+    const QVariantMap sent = userProperties;
+    for (QVariantMap::const_iterator it = sent.constBegin(); it != sent.constEnd(); ++it)
+        m_sentUserProperties.insert(it.key(), it.value());
+    m_sentUserPropertiesChanged = true;
+}
+
+void QAmplitudeAnalytics::forgetSentUserProperties(const QByteArray &identify)
+{
+    // The server dropped the $identify event, so its properties
+    // have to be sent again with the next event
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    foreach (const QString &key, setUserPropertyKeys(identify))
+        m_sentUserProperties.remove(key);
+    m_sentUserPropertiesChanged = true;
+    m_userPropertiesChanged = true;
+#else
+    Q_UNUSED(identify)
+    resetSentUserProperties();
+#endif
+}
+
+void QAmplitudeAnalytics::resetSentUserProperties()
+{
+    m_sentUserProperties.clear();
+    m_sentUserPropertiesChanged = true;
+    m_userPropertiesChanged = true;
+}
+#endif
+
+void QAmplitudeAnalytics::updateSession(qint64 time)
+{
+    if (m_sessionId >= 0 && time - m_lastEventTime <= m_sessionTimeout) {
+        m_lastEventTime = qMax(m_lastEventTime, time);
+        return;
+    }
+
+    if (m_sessionId >= 0 && m_sessionEventsEnabled) {
+        QVariantHash end;
+        fillCommonProperties(end, QVariantMap());
+        end.insert(QLatin1String("event_type"), QLatin1String("session_end"));
+        queueEvent(end, m_lastEventTime);
+    }
+
+    m_sessionId = time;
+    m_lastEventTime = time;
+    if (m_sessionEventsEnabled) {
+        QVariantHash start;
+        fillCommonProperties(start, QVariantMap());
+        start.insert(QLatin1String("event_type"), QLatin1String("session_start"));
+        queueEvent(start, time);
+    }
+    saveSession();
+}
+
+void QAmplitudeAnalytics::saveSession()
+{
+    // Also saved with every block of event ids. In between, the last
+    // event time isn't saved, so a session may end earlier than it
+    // should after a crash.
+    m_settings->setValue(QLatin1String("SessionId"), m_sessionId);
+    m_settings->setValue(QLatin1String("LastEventTime"), m_lastEventTime);
+}
+
+void QAmplitudeAnalytics::queueChanged()
+{
+    ++m_unsavedChanges;
+
+    switch (m_persistenceMode) {
+    case PersistImmediately:
+        persistQueuedEvents();
+        break;
+    case PersistPeriodically:
+        if (m_unsavedChanges >= m_persistEventThreshold)
+            persistQueuedEvents();
+        break;
+    case PersistOnExit:
+        // Saved on aboutToQuit() or on destruction
+        break;
+    }
+}
+
+void QAmplitudeAnalytics::writeQueuedEvents()
+{
+    foreach (const QByteArray &event, m_queue)
+        m_eventQueue->append(event);
+    m_queue.clear();
+    m_queueBytes = 0;
 }
@@ -30,36 +30,132 @@
 #define QAMPLITUDEANALYTICS_H
 
 #include <QObject>
+#include <QUrl>
 #include <QStringList>
+#include <QSet>
+#include <QSharedPointer>
 #include <QVariantMap>
+#include <QElapsedTimer>
 #include <QSslConfiguration>
 
+class QTimer;
+class QEvent;
 class QSettings;
+class QAmplitudeEventQueue;
+class QAmplitudeBatchController;
+class QAmplitudeIdGenerator;
+class QAmplitudeEventClock;
 class QNetworkAccessManager;
 class QNetworkReply;
+class QNetworkConfigurationManager;
 class QAmplitudeAnalytics: public QObject
 {
     Q_OBJECT
+    Q_ENUMS(PersistenceMode UploadPolicy NetworkState)
 
     Q_PROPERTY(QString apiKey READ apiKey WRITE setApiKey NOTIFY apiKeyChanged)
+    Q_PROPERTY(QUrl serverUrl READ serverUrl WRITE setServerUrl NOTIFY serverUrlChanged)
 
     Q_PROPERTY(QString appVersion READ appVersion WRITE setAppVersion NOTIFY appVersionChanged)
     Q_PROPERTY(QString userId READ userId WRITE setUserId NOTIFY userIdChanged)
     Q_PROPERTY(QVariantMap persistentUserProperties READ persistentUserProperties
                                                     WRITE setPersistentUserProperties
                                                     NOTIFY persistentUserPropertiesChanged)
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    Q_PROPERTY(bool userPropertiesDeltaEnabled READ isUserPropertiesDeltaEnabled
+                                               WRITE setUserPropertiesDeltaEnabled
+                                               NOTIFY userPropertiesDeltaEnabledChanged)
+#endif
     Q_PROPERTY(DeviceInfo deviceInfo READ deviceInfo WRITE setDeviceInfo NOTIFY deviceInfoChanged)
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     Q_PROPERTY(LocationInfo locationInfo READ locationInfo
                                          WRITE setLocationInfo
                                          NOTIFY locationInfoChanged)
+#endif
     Q_PROPERTY(QString language READ language WRITE setLanguage NOTIFY languageChanged)
 
     Q_PROPERTY(bool privacyEnabled READ isPrivacyEnabled
                                    WRITE setPrivacyEnabled
                                    NOTIFY privacyEnabledChanged)
 
+    Q_PROPERTY(int sessionTimeout READ sessionTimeout
+                                  WRITE setSessionTimeout
+                                  NOTIFY sessionTimeoutChanged)
+    Q_PROPERTY(bool sessionEventsEnabled READ isSessionEventsEnabled
+                                         WRITE setSessionEventsEnabled
+                                         NOTIFY sessionEventsEnabledChanged)
+
+    Q_PROPERTY(PersistenceMode persistenceMode READ persistenceMode
+                                               WRITE setPersistenceMode
+                                               NOTIFY persistenceModeChanged)
+    Q_PROPERTY(int persistInterval READ persistInterval
+                                   WRITE setPersistInterval
+                                   NOTIFY persistIntervalChanged)
+    Q_PROPERTY(int persistEventThreshold READ persistEventThreshold
+                                         WRITE setPersistEventThreshold
+                                         NOTIFY persistEventThresholdChanged)
+    Q_PROPERTY(bool queueCompressionEnabled READ isQueueCompressionEnabled
+                                            WRITE setQueueCompressionEnabled
+                                            NOTIFY queueCompressionEnabledChanged)
+
+    Q_PROPERTY(UploadPolicy uploadPolicy READ uploadPolicy
+                                         WRITE setUploadPolicy
+                                         NOTIFY uploadPolicyChanged)
+    Q_PROPERTY(NetworkState networkState READ networkState NOTIFY networkStateChanged)
+    Q_PROPERTY(NetworkState networkStateOverride READ networkStateOverride
+                                                 WRITE setNetworkStateOverride
+                                                 NOTIFY networkStateChanged)
+
 public:
 
+    // Controls when queued events are synced to disk and what can be
+    // lost if the process crashes or the device loses power. Events are
+    // also written to the queue, without syncing, whenever they are sent,
+    // i.e. on every trackEvent() that isn't postponed.
+    //  * PersistImmediately - the queue is synced to disk after every
+    //    change. Nothing that trackEvent() has returned for is lost.
+    //    Events that were sent right before a crash may be sent again.
+    //  * PersistPeriodically - changes are grouped and synced every
+    //    persistInterval milliseconds or after persistEventThreshold
+    //    changes, whichever comes first. Up to that many events are lost
+    //    on power loss. A process crash loses only postponed events
+    //    that weren't synced or sent yet.
+    //  * PersistOnExit - the queue is synced only on
+    //    QCoreApplication::aboutToQuit(), on destruction or when
+    //    persistQueuedEvents() is called. Power loss loses everything
+    //    since then, a process crash loses postponed events not sent yet.
+    // When built without persistence, the queue is kept in memory only
+    // and the mode just controls how often events are moved there.
+    enum PersistenceMode {
+        PersistImmediately,
+        PersistPeriodically,
+        PersistOnExit
+    };
+
+    // Controls when queued events are uploaded:
+    //  * UploadAlways - whenever there are events to send (default).
+    //  * UploadWhenOnline - only while the device is online.
+    //  * UploadOnUnmeteredNetwork - only over Wi-Fi or Ethernet, events
+    //    are kept for bulk uploads instead of using mobile data.
+    //  * UploadPiggyback - over mobile data only shortly after other
+    //    network traffic of the application, which it reports with
+    //    notifyNetworkActivity(), while the radio is still active.
+    //    Over Wi-Fi or Ethernet at any time.
+    // Where the network state can't be determined, uploads are allowed.
+    enum UploadPolicy {
+        UploadAlways,
+        UploadWhenOnline,
+        UploadOnUnmeteredNetwork,
+        UploadPiggyback
+    };
+
+    enum NetworkState {
+        NetworkStateUnknown,
+        NetworkOffline,
+        NetworkMetered,
+        NetworkUnmetered
+    };
+
     struct DeviceInfo {
         QString id;
         QString brand;
@@ -90,6 +186,10 @@ public:
     QString apiKey() const;
     void setApiKey(const QString &apiKey);
 
+    // Endpoint of the primary destination, the HTTP API by default
+    QUrl serverUrl() const;
+    void setServerUrl(const QUrl &url);
+
     QString appVersion() const;
     void setAppVersion(const QString &version);
 
@@ -99,11 +199,22 @@ public:
     QVariantMap persistentUserProperties() const;
     void setPersistentUserProperties(const QVariantMap &properties);
 
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    // Events don't carry user properties. Instead, when they change, an
+    // $identify event that sets only the changed ones is tracked before
+    // the event. Values already sent are remembered across restarts.
+    // identifyUser() still sends the properties it's given as they are.
+    bool isUserPropertiesDeltaEnabled() const;
+    void setUserPropertiesDeltaEnabled(bool enabled);
+#endif
+
     DeviceInfo deviceInfo() const;
     void setDeviceInfo(const DeviceInfo &info);
 
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     LocationInfo locationInfo() const;
     void setLocationInfo(const LocationInfo &info);
+#endif
 
     QString language() const;
     void setLanguage(const QString &language);
@@ -111,17 +222,93 @@ public:
     bool isPrivacyEnabled() const;
     void setPrivacyEnabled(bool enabled);
 
+    // A new session starts when no events were tracked for this long
+    // (in milliseconds), also counting time spent in the background.
+    // The session ends at the last event before the gap. Sessions only
+    // start with a tracked event, activating the application doesn't.
+    int sessionTimeout() const;
+    void setSessionTimeout(int msecs);
+
+    // Tracks session_start and session_end events
+    bool isSessionEventsEnabled() const;
+    void setSessionEventsEnabled(bool enabled);
+
+    PersistenceMode persistenceMode() const;
+    void setPersistenceMode(PersistenceMode mode);
+
+    int persistInterval() const;
+    void setPersistInterval(int msecs);
+
+    int persistEventThreshold() const;
+    void setPersistEventThreshold(int count);
+
+    // Compresses queued events on disk in blocks of a few hundred
+    // kilobytes. Saves storage and flash writes for large queues at
+    // the cost of some CPU time when a block is filled or read.
+    bool isQueueCompressionEnabled() const;
+    void setQueueCompressionEnabled(bool enabled);
+
+    UploadPolicy uploadPolicy() const;
+    void setUploadPolicy(UploadPolicy policy);
+
+    // Detected with QNetworkConfigurationManager once an upload policy
+    // other than UploadAlways is set, unless overridden with
+    // networkStateOverride (e.g. for testing). Always unknown with Qt
+    // 5.15 and later, where bearer management is deprecated.
+    // NetworkStateUnknown removes the override.
+    NetworkState networkState() const;
+    NetworkState networkStateOverride() const;
+    void setNetworkStateOverride(NetworkState state);
+
+    // Sends every event to an additional project (API key) and/or
+    // endpoint. Events are serialized and stored once, each destination
+    // keeps its own position in the event queue. A new destination only
+    // gets events tracked after it was first added, and an $identify
+    // event with the user properties sent so far if the delta of user
+    // properties is enabled. Positions are stored with the event queue
+    // and kept across restarts, destinations have to be added again after
+    // every start to continue from them.
+    void addDestination(const QString &apiKey, const QUrl &url = QUrl());
+    void removeDestination(const QString &apiKey, const QUrl &url = QUrl());
+    // Removes positions of destinations that weren't added since the
+    // start, their events would be kept forever otherwise. Call it once
+    // every destination that is still used has been added.
+    void removeStaleDestinations();
+
+#ifndef QAMPLITUDEANALYTICS_NO_METRICS
+    // Current state of the event queue and of the uploader: queue size,
+    // the number of events rejected by the server and, in destinations,
+    // the apiKey, url and queuedEvents of every destination with the batch
+    // size and requests in flight chosen by its adaptive batching, as well
+    // as the round-trip time, bandwidth and error rate they are based on.
+    Q_INVOKABLE QVariantMap metrics() const;
+#endif
+
     ~QAmplitudeAnalytics();
 
 signals:
     void apiKeyChanged();
+    void serverUrlChanged();
     void userIdChanged();
     void persistentUserPropertiesChanged();
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    void userPropertiesDeltaEnabledChanged();
+#endif
     void appVersionChanged();
     void deviceInfoChanged();
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     void locationInfoChanged();
+#endif
     void languageChanged();
     void privacyEnabledChanged();
+    void sessionTimeoutChanged();
+    void sessionEventsEnabledChanged();
+    void persistenceModeChanged();
+    void persistIntervalChanged();
+    void persistEventThresholdChanged();
+    void queueCompressionEnabledChanged();
+    void uploadPolicyChanged();
+    void networkStateChanged();
 
 public slots:
     void trackEvent(const QString &eventType,
@@ -134,44 +321,144 @@ public slots:
                     const QVariant &revenue = QVariant(),
                     bool postpone = false);
 
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
     void identifyUser(const QVariantMap &userProperties = QVariantMap(),
                       const QVariant paying = QVariant(),
                       const QString &startVersion = QString());
+#endif
 
     void sendQueuedEvents();
     void clearQueuedEvents();
+    void persistQueuedEvents();
+
+    // Called by the application when it uses the network, so
+    // that events can be uploaded while the radio is active
+    void notifyNetworkActivity();
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event);
 
 private slots:
     void onNetworkReply(QNetworkReply *reply);
+    void onRequestTimer();
+    void onNetworkChanged();
 
 private:
+    struct Batch {
+        Batch(): reply(NULL), begin(0), end(0), bytes(0), done(false) {}
+
+        QNetworkReply *reply;
+        qint64 begin;
+        qint64 end;
+        qint64 bytes;
+        bool done;
+        QElapsedTimer timer;
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+        // $identify events by their queue index, to forget
+        // the properties they set if they are rejected
+        QMap<qint64, QByteArray> identifies;
+#endif
+    };
+
+    struct Destination {
+        Destination()
+            : shouldSend(false), pausedUntil(0), backoff(0) {}
+
+        QString apiKey;
+        QUrl url;
+        QString reader;
+        // Each endpoint has its own latency and limits
+        QSharedPointer<QAmplitudeBatchController> batchController;
+        QList<Batch> batches;
+        bool shouldSend;
+        // Queue indexes of events rejected by the server, skipped
+        // when sending until they are committed
+        QSet<qint64> rejected;
+        // Time on requestClock() until which nothing is sent
+        qint64 pausedUntil;
+        int backoff;
+    };
+
     QString m_apiKey;
 
     QString m_appVersion;
 
     QString m_userId;
     QVariantMap m_userProperties;
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    bool m_userPropertiesDeltaEnabled;
+    bool m_userPropertiesChanged;
+    // User properties as sent in $identify events (to every destination)
+    QVariantMap m_sentUserProperties;
+    bool m_sentUserPropertiesChanged;
+#endif
 
     DeviceInfo m_device;
+#ifndef QAMPLITUDEANALYTICS_NO_LOCATION
     LocationInfo m_location;
+#endif
     QString m_language;
 
     bool m_privacyEnabled;
 
     qint64 m_sessionId;
+    qint64 m_lastEventTime;
     quint32 m_lastEventId;
-
-    bool m_shouldSend;
-    QStringList m_queue;
-    QStringList m_pending;
+    quint32 m_reservedEventId;
+    int m_sessionTimeout;
+    bool m_sessionEventsEnabled;
+
+    QList<QByteArray> m_queue;
+    int m_queueBytes;
+    QList<Destination> m_destinations;
+#ifndef QAMPLITUDEANALYTICS_NO_METRICS
+    int m_rejectedEvents;
+#endif
+    QElapsedTimer m_clock;
+
+    PersistenceMode m_persistenceMode;
+    int m_persistInterval;
+    int m_persistEventThreshold;
+    int m_unsavedChanges;
+    QTimer *m_persistTimer;
 
     QSslConfiguration m_sslConfiguration;
     QScopedPointer<QSettings> m_settings;
+    QScopedPointer<QAmplitudeEventQueue> m_eventQueue;
     QScopedPointer<QNetworkAccessManager> m_nam;
-    QNetworkReply *m_reply;
-
+    QTimer *m_requestTimer;
+    QScopedPointer<QAmplitudeIdGenerator> m_idGenerator;
+    QScopedPointer<QAmplitudeEventClock> m_eventClock;
+
+    UploadPolicy m_uploadPolicy;
+    NetworkState m_detectedNetworkState;
+    NetworkState m_networkStateOverride;
+    QElapsedTimer m_networkActivity;
+    QNetworkConfigurationManager *m_networkManager;
+
+    void sendQueuedEvents(Destination &destination);
+    void abortRequests(Destination &destination);
+    void commitBatches(Destination &destination);
+    void abandonBatches(Destination &destination, int first);
+    bool rejectEvents(Destination &destination, int batch, const QByteArray &response);
+    void pause(Destination &destination, qint64 msecs);
+    qint64 requestClock() const;
+    bool isUploadAllowed() const;
+    void resumeUploads();
+    void watchNetwork();
+    NetworkState detectNetworkState() const;
     void fillCommonProperties(QVariantHash &hashMap, const QVariantMap &userProperties) const;
-    void saveToSettings();
+    void queueEvent(QVariantHash &event, qint64 time);
+#ifndef QAMPLITUDEANALYTICS_NO_IDENTIFY
+    void queueUserPropertyChanges(const QVariantMap &userProperties, qint64 time);
+    void queueSetUserProperties(const QVariantMap &userProperties, qint64 time);
+    void forgetSentUserProperties(const QByteArray &identify);
+    void resetSentUserProperties();
+#endif
+    void updateSession(qint64 time);
+    void saveSession();
+    void queueChanged();
+    void writeQueuedEvents();
 };
 
 inline bool operator ==(const QAmplitudeAnalytics::DeviceInfo::OsInfo &first,
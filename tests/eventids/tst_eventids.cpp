@@ -0,0 +1,126 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Checks insert_ids and benchmarks insert_id and timestamp generation
+// of events against the Qt calls they replace.
+
+#include "eventclock_p.h"
+#include "idgenerator_p.h"
+
+#include <QDateTime>
+#include <QSet>
+#include <QUuid>
+#include <QtTest>
+
+class EventIdsBenchmark: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void uuidFormat();
+    void uuidUniqueness();
+    void quuid();
+    void idGenerator();
+    void currentDateTimeUtc();
+    void eventClock();
+};
+
+void EventIdsBenchmark::uuidFormat()
+{
+    QAmplitudeIdGenerator generator;
+    for (int i = 0; i < 1000; ++i) {
+        const QString id = generator.createUuid();
+        QCOMPARE(id.length(), 36);
+        bool ok = false;
+        // Version nibble 4, variant bits 10xx
+        QCOMPARE(id.mid(14, 1).toUInt(&ok, 16), 4u);
+        QVERIFY(ok);
+        QCOMPARE(id.mid(19, 1).toUInt(&ok, 16) & 0xC, 0x8u);
+        QVERIFY(ok);
+        QCOMPARE(QUuid(id).version(), QUuid::Random);
+        QCOMPARE(QUuid(id).variant(), QUuid::DCE);
+        QCOMPARE(QUuid(id).toString().mid(1, 36), id);
+    }
+}
+
+void EventIdsBenchmark::uuidUniqueness()
+{
+    // Also across generators created at the same time
+    QAmplitudeIdGenerator first;
+    QAmplitudeIdGenerator second;
+    QSet<QString> ids;
+    for (int i = 0; i < 100000; ++i) {
+        ids.insert(first.createUuid());
+        ids.insert(second.createUuid());
+    }
+    QCOMPARE(ids.count(), 200000);
+}
+
+void EventIdsBenchmark::quuid()
+{
+    QString id;
+    QBENCHMARK {
+        id = QUuid::createUuid().toString();
+        id = id.mid(1);
+        id.chop(1);
+    }
+    QCOMPARE(id.length(), 36);
+}
+
+void EventIdsBenchmark::idGenerator()
+{
+    QAmplitudeIdGenerator generator;
+    QString id;
+    QBENCHMARK {
+        id = generator.createUuid();
+    }
+    QCOMPARE(id.length(), 36);
+}
+
+void EventIdsBenchmark::currentDateTimeUtc()
+{
+    qint64 time = 0;
+    QBENCHMARK {
+        time = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch();
+    }
+    QVERIFY(time > 0);
+}
+
+void EventIdsBenchmark::eventClock()
+{
+    QAmplitudeEventClock clock;
+    qint64 time = 0;
+    QBENCHMARK {
+        time = clock.currentMSecsSinceEpoch();
+    }
+    QVERIFY(qAbs(time - QDateTime::currentDateTimeUtc().toMSecsSinceEpoch()) < 2000);
+}
+
+QTEST_APPLESS_MAIN(EventIdsBenchmark)
+
+#include "tst_eventids.moc"
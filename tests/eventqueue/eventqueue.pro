@@ -0,0 +1,51 @@
+##################################################################################
+#
+#  Qt In-App Analytics
+#
+#  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#
+#  * Redistributions of source code must retain the above copyright notice, this
+#    list of conditions and the following disclaimer.
+#
+#  * Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+#  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+#  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+#  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+#  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+#  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+#  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+#  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+##################################################################################
+
+!greaterThan(QT_MAJOR_VERSION, 4) {
+    error("tst_eventqueue requires Qt 5")
+}
+
+TEMPLATE = app
+TARGET = tst_eventqueue
+
+QT = core testlib
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += \
+    $$PWD/../../src/amplitudeanalytics
+
+HEADERS += \
+    $$PWD/../../src/amplitudeanalytics/crc32cfunctions_p.h \
+    $$PWD/../../src/amplitudeanalytics/eventqueue_p.h
+
+SOURCES += \
+    $$PWD/../../src/amplitudeanalytics/eventqueue.cpp \
+    $$PWD/tst_eventqueue.cpp
@@ -0,0 +1,83 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Tests recovery of the event queue from corrupted segments.
+
+#include "eventqueue_p.h"
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+class EventQueueTest: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void corruptedMiddleSegment();
+};
+
+void EventQueueTest::corruptedMiddleSegment()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // Two records fill a segment: 1 holds 0 and 1, 2 holds 2 and 3...
+    QList<QByteArray> records;
+    for (int i = 0; i < 7; ++i)
+        records.append(QByteArray(100000, char('a' + i)));
+
+    {
+        QAmplitudeEventQueue queue(dir.path());
+        foreach (const QByteArray &record, records)
+            queue.append(record);
+        queue.flush(true);
+
+        // Leaves the cursor inside segment 2
+        QCOMPARE(queue.read(QString(), 3).count(), 3);
+        queue.commit(QString());
+        queue.flush(true);
+    }
+
+    QFile segment(QDir(dir.path()).filePath(QLatin1String("00000002.seg")));
+    QVERIFY(segment.open(QFile::ReadWrite));
+    QVERIFY(segment.write(QByteArray(8, '\0')) == 8);
+    segment.close();
+
+    // Records of the intact segments after the corrupted one are still read
+    QAmplitudeEventQueue queue(dir.path());
+    QList<QByteArray> read;
+    foreach (const QByteArray &record, queue.read(QString()))
+        read.append(QByteArray(record.constData(), record.size()));
+    QCOMPARE(read, records.mid(4));
+}
+
+QTEST_APPLESS_MAIN(EventQueueTest)
+
+#include "tst_eventqueue.moc"
@@ -0,0 +1,90 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// libFuzzer entry point for the JSON serializer. The input drives the
+// shape and contents of a QVariant tree, whose serialization has to
+// match the frozen reference copy and, unless it has known quirks,
+// parse with QJsonDocument to the expected JSON. The input is also
+// quoted as a string on its own. AFL++ can run it through its libFuzzer
+// driver (afl-clang-fast++ -fsanitize=fuzzer).
+
+#include "jsonfunctions_p.h"
+#include "referencejson.h"
+#include "varianttree.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace {
+
+const Corpus FuzzCorpus = { "fuzz", 4, 8, 30, true, true };
+
+void checkString(const QString &string)
+{
+    const QString quoted = quoteAndEscape(string);
+    if (quoted != ReferenceJson::quoteAndEscape(string))
+        qFatal("quoteAndEscape() differs from the reference");
+    if (VariantTree::isQuirk(string, false))
+        return;
+
+    const QJsonArray array = QJsonDocument::fromJson(
+                QString(QLatin1Char('[') + quoted + QLatin1Char(']')).toUtf8()).array();
+    if (array.count() != 1
+            || !VariantTree::sameJson(array.at(0), VariantTree::expectedString(string))) {
+        qFatal("quoteAndEscape() output doesn't parse back");
+    }
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > 64 * 1024)
+        return 0;
+
+    checkString(QString::fromUtf8(reinterpret_cast<const char *>(data), int(size)));
+
+    DataEntropy entropy(data, int(size));
+    const QVariantMap tree = VariantTree::map(entropy, FuzzCorpus);
+    const QString json = toJson(tree);
+    if (json != ReferenceJson::toJson(tree))
+        qFatal("toJson() differs from the reference");
+    if (VariantTree::hasQuirks(tree))
+        return 0;
+
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(json.toUtf8(), &error);
+    if (error.error != QJsonParseError::NoError)
+        qFatal("toJson() output isn't valid JSON: %s", qPrintable(error.errorString()));
+    if (!VariantTree::sameJson(document.object(), VariantTree::expected(tree)))
+        qFatal("toJson() output doesn't parse to the expected JSON");
+    return 0;
+}
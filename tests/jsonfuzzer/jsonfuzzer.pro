@@ -0,0 +1,61 @@
+##################################################################################
+#
+#  Qt In-App Analytics
+#
+#  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#
+#  * Redistributions of source code must retain the above copyright notice, this
+#    list of conditions and the following disclaimer.
+#
+#  * Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+#  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+#  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+#  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+#  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+#  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+#  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+#  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+##################################################################################
+
+# Build with clang, e.g. qmake -spec linux-clang, and run with a corpus
+# directory: ./jsonfuzzer corpus/
+
+!greaterThan(QT_MAJOR_VERSION, 4) {
+    error("jsonfuzzer requires Qt 5")
+}
+!contains(QMAKE_COMPILER, clang) {
+    error("jsonfuzzer requires clang")
+}
+
+TEMPLATE = app
+TARGET = jsonfuzzer
+
+QT = core
+CONFIG += console
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS += -fsanitize=fuzzer,address,undefined
+QMAKE_LFLAGS += -fsanitize=fuzzer,address,undefined
+
+INCLUDEPATH += \
+    $$PWD/../../src/amplitudeanalytics \
+    $$PWD/../jsonserializer
+
+HEADERS += \
+    $$PWD/../../src/amplitudeanalytics/jsonfunctions_p.h \
+    $$PWD/../jsonserializer/referencejson.h \
+    $$PWD/../jsonserializer/varianttree.h
+
+SOURCES += \
+    $$PWD/fuzzer.cpp
@@ -0,0 +1,208 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Differential test of the JSON serializer. Random QVariant trees are
+// serialized and compared byte for byte with the frozen reference copy
+// of the serializer, and what QJsonDocument parses is compared with the
+// expected JSON, except for trees with known quirks. Also reports the
+// throughput of both serializers for every corpus.
+
+#include "jsonfunctions_p.h"
+#include "referencejson.h"
+#include "varianttree.h"
+
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QtTest>
+
+namespace {
+
+const Corpus Corpora[] = {
+    // name, maxDepth, maxChildren, numericStrings, specialCharacters, quirks
+    { "flat", 1, 20, 10, false, false },
+    { "nested", 5, 5, 10, false, false },
+    { "escaping", 2, 10, 0, true, false },
+    { "numbers", 2, 10, 80, false, false },
+    { "quirks", 3, 8, 30, true, true }
+};
+const int CorpusCount = int(sizeof(Corpora) / sizeof(Corpora[0]));
+const int TreesPerCorpus = 2000;
+
+} // namespace
+
+class JsonSerializerTest: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void reference_data();
+    void reference();
+    void qJsonDocument_data();
+    void qJsonDocument();
+    void throughput_data();
+    void throughput();
+
+private:
+    QList<QList<QVariantMap> > m_trees;
+
+    void addCorpusRows();
+};
+
+void JsonSerializerTest::initTestCase()
+{
+    for (int i = 0; i < CorpusCount; ++i) {
+        // Same trees every run
+        RandomEntropy entropy(quint32(i + 1) * 2654435761u);
+        QList<QVariantMap> trees;
+        for (int j = 0; j < TreesPerCorpus; ++j)
+            trees.append(VariantTree::map(entropy, Corpora[i]));
+        m_trees.append(trees);
+    }
+}
+
+void JsonSerializerTest::addCorpusRows()
+{
+    QTest::addColumn<int>("corpus");
+    for (int i = 0; i < CorpusCount; ++i)
+        QTest::newRow(Corpora[i].name) << i;
+}
+
+void JsonSerializerTest::reference_data()
+{
+    addCorpusRows();
+}
+
+void JsonSerializerTest::reference()
+{
+    QFETCH(int, corpus);
+    foreach (const QVariantMap &tree, m_trees.at(corpus)) {
+        const QString json = toJson(tree);
+        QCOMPARE(json, ReferenceJson::toJson(tree));
+
+        QVariantHash hash;
+        for (QVariantMap::const_iterator it = tree.constBegin(); it != tree.constEnd(); ++it) {
+            hash.insert(it.key(), it.value());
+            QCOMPARE(quoteAndEscape(it.key()), ReferenceJson::quoteAndEscape(it.key()));
+            QCOMPARE(toJsonString(it.value()), ReferenceJson::toJsonString(it.value()));
+
+            switch (it.value().type()) {
+            case QVariant::String:
+                QCOMPARE(quoteAndEscape(it.value().toString()),
+                         ReferenceJson::quoteAndEscape(it.value().toString()));
+                // Fall through
+            case QVariant::Int:
+            case QVariant::UInt:
+            case QVariant::LongLong:
+            case QVariant::Double:
+                QCOMPARE(doubleToString(it.value(), 2),
+                         ReferenceJson::doubleToString(it.value(), 2));
+                QCOMPARE(doubleToString(it.value(), 15),
+                         ReferenceJson::doubleToString(it.value(), 15));
+                break;
+            default:
+                break;
+            }
+        }
+        QCOMPARE(toJson(hash), ReferenceJson::toJson(hash));
+    }
+}
+
+void JsonSerializerTest::qJsonDocument_data()
+{
+    addCorpusRows();
+}
+
+void JsonSerializerTest::qJsonDocument()
+{
+    QFETCH(int, corpus);
+    int quirks = 0;
+    foreach (const QVariantMap &tree, m_trees.at(corpus)) {
+        if (VariantTree::hasQuirks(tree)) {
+            ++quirks;
+            continue;
+        }
+
+        const QByteArray json = toJson(tree).toUtf8();
+        QJsonParseError error;
+        const QJsonDocument document = QJsonDocument::fromJson(json, &error);
+        if (error.error != QJsonParseError::NoError)
+            QFAIL(qPrintable(error.errorString() + QLatin1String(": ") + QString::fromUtf8(json)));
+        if (!VariantTree::sameJson(document.object(), VariantTree::expected(tree)))
+            QFAIL(qPrintable(QLatin1String("Unexpected JSON: ") + QString::fromUtf8(json)));
+    }
+
+    if (Corpora[corpus].quirks)
+        qDebug("%d of %d trees with known quirks skipped", quirks, m_trees.at(corpus).count());
+    else
+        QCOMPARE(quirks, 0);
+}
+
+void JsonSerializerTest::throughput_data()
+{
+    addCorpusRows();
+}
+
+void JsonSerializerTest::throughput()
+{
+    QFETCH(int, corpus);
+    const QList<QVariantMap> &trees = m_trees.at(corpus);
+
+    // Passes over the corpus until at least this long, in milliseconds
+    const qint64 MinTime = 200;
+    qint64 characters = 0;
+    qint64 serialized = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        foreach (const QVariantMap &tree, trees)
+            characters += toJson(tree).size();
+        serialized += trees.count();
+    } while (timer.elapsed() < MinTime);
+    const qint64 time = timer.nsecsElapsed();
+
+    qint64 referenceSerialized = 0;
+    timer.start();
+    do {
+        foreach (const QVariantMap &tree, trees)
+            ReferenceJson::toJson(tree);
+        referenceSerialized += trees.count();
+    } while (timer.elapsed() < MinTime);
+    const qint64 referenceTime = timer.nsecsElapsed();
+
+    const qreal treesPerSecond = serialized * 1e9 / time;
+    const qreal referenceTreesPerSecond = referenceSerialized * 1e9 / referenceTime;
+    qDebug("%s: toJson() %.0f trees/s, %.1f M characters/s; reference %.0f trees/s (%.2fx)",
+           Corpora[corpus].name, treesPerSecond, characters * 1e3 / time,
+           referenceTreesPerSecond, treesPerSecond / referenceTreesPerSecond);
+}
+
+QTEST_APPLESS_MAIN(JsonSerializerTest)
+
+#include "tst_jsonserializer.moc"
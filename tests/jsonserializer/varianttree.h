@@ -0,0 +1,432 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VARIANTTREE_H
+#define VARIANTTREE_H
+
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QRegExp>
+#include <QStringList>
+#include <QUrl>
+#include <QVariant>
+
+#include <cmath>
+
+// Random QVariant trees for checking the JSON serializer, and the JSON
+// that their serialization is expected to parse to. Used by both the
+// differential test and the fuzzer, which differ in where the choices
+// come from.
+
+class Entropy
+{
+public:
+    virtual ~Entropy() {}
+    virtual quint32 next() = 0;
+
+    // In [0, n)
+    int bounded(int n) { return n > 0 ? int(next() % quint32(n)) : 0; }
+
+    quint64 wide()
+    {
+        quint64 value = 0;
+        for (int i = 0; i < 8; ++i)
+            value = (value << 8) | (next() & 0xFF);
+        return value;
+    }
+};
+
+// xorshift32, reproducible for a given seed
+class RandomEntropy: public Entropy
+{
+public:
+    explicit RandomEntropy(quint32 seed): m_state(seed | 1) {}
+
+    quint32 next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+
+private:
+    quint32 m_state;
+};
+
+// A byte of input per choice, zeros once the input runs out, which
+// ends the tree
+class DataEntropy: public Entropy
+{
+public:
+    DataEntropy(const uchar *data, int size): m_data(data), m_size(size), m_position(0) {}
+
+    quint32 next() { return m_position < m_size ? m_data[m_position++] : 0; }
+
+private:
+    const uchar *m_data;
+    int m_size;
+    int m_position;
+};
+
+struct Corpus {
+    const char *name;
+    int maxDepth;
+    int maxChildren;
+    // Percentage of string values that look like numbers
+    int numericStrings;
+    // Strings include characters that need escaping and non-ASCII ones
+    bool specialCharacters;
+    // Also numeric-looking keys, non-canonical numbers and unescaped
+    // control characters, which are known to make the output invalid
+    bool quirks;
+};
+
+namespace VariantTree {
+
+inline QString numericString(Entropy &entropy, bool canonical)
+{
+    QString string;
+    if (entropy.bounded(4) == 0)
+        string.append(QLatin1Char('-'));
+    else if (!canonical && entropy.bounded(4) == 0)
+        string.append(QLatin1Char('+'));
+
+    const int digits = 1 + entropy.bounded(12);
+    for (int i = 0; i < digits; ++i) {
+        int digit = entropy.bounded(10);
+        if (canonical && i == 0 && digits > 1 && digit == 0)
+            digit = 1;
+        string.append(QLatin1Char('0' + digit));
+    }
+    if (entropy.bounded(3) == 0) {
+        string.append(QLatin1Char('.'));
+        const int decimals = 1 + entropy.bounded(6);
+        for (int i = 0; i < decimals; ++i)
+            string.append(QLatin1Char('0' + entropy.bounded(10)));
+    }
+    return string;
+}
+
+inline QString text(Entropy &entropy, const Corpus &corpus)
+{
+    static const char plain[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ _";
+    static const ushort special[] = {
+        '"', '\\', '/', '\b', '\f', '\n', '\r', '\t', 0x7F, 0xE9, 0x436, 0x20AC, 0xFEFF
+    };
+    static const ushort control[] = { 0x01, 0x1B, 0x1F };
+    const int specials = int(sizeof(special) / sizeof(special[0]));
+
+    QString string;
+    const int length = entropy.bounded(17);
+    for (int i = 0; i < length; ++i) {
+        const int kind = entropy.bounded(8);
+        if (corpus.quirks && kind == 0) {
+            string.append(QChar(control[entropy.bounded(3)]));
+        } else if (corpus.specialCharacters && kind == 1) {
+            string.append(QChar(special[entropy.bounded(specials)]));
+        } else if (corpus.specialCharacters && kind == 2) {
+            // U+1F600, outside of the BMP
+            string.append(QChar(0xD83D)).append(QChar(0xDE00));
+        } else {
+            string.append(QLatin1Char(plain[entropy.bounded(int(sizeof(plain)) - 1)]));
+        }
+    }
+    return string;
+}
+
+inline QString key(Entropy &entropy, const Corpus &corpus)
+{
+    if (corpus.quirks && entropy.bounded(8) == 0)
+        return numericString(entropy, true);
+    return text(entropy, corpus);
+}
+
+inline QString stringValue(Entropy &entropy, const Corpus &corpus)
+{
+    if (entropy.bounded(100) < corpus.numericStrings)
+        return numericString(entropy, !corpus.quirks || entropy.bounded(2) == 0);
+    return text(entropy, corpus);
+}
+
+inline QVariant value(Entropy &entropy, const Corpus &corpus, int depth);
+
+inline QVariantMap map(Entropy &entropy, const Corpus &corpus, int depth = 0)
+{
+    QVariantMap map;
+    const int count = entropy.bounded(corpus.maxChildren + 1);
+    for (int i = 0; i < count; ++i)
+        map.insert(key(entropy, corpus), value(entropy, corpus, depth + 1));
+    return map;
+}
+
+inline QVariant value(Entropy &entropy, const Corpus &corpus, int depth)
+{
+    const bool leaf = depth >= corpus.maxDepth;
+    switch (entropy.bounded(leaf ? 12 : 16)) {
+    case 0:
+        return QVariant();
+    case 1:
+        return entropy.bounded(2) == 1;
+    case 2:
+        return int(entropy.next());
+    case 3:
+        return uint(entropy.next());
+    case 4:
+        return qint64(entropy.wide());
+    case 5:
+    {
+        // Finite only, NaN and infinity aren't supported
+        const double mantissa = double(qint64(entropy.wide() >> 11)) - double(Q_INT64_C(1) << 52);
+        return mantissa / std::pow(10.0, entropy.bounded(40) - 20);
+    }
+    case 6:
+        return QChar(ushort('a' + entropy.bounded(26)));
+    case 7:
+        return QUrl(QLatin1String("http://example.com/") + text(entropy, corpus));
+    case 8:
+        return QDateTime::fromMSecsSinceEpoch(qint64(entropy.wide() % Q_UINT64_C(4102444800000)))
+                .toUTC();
+    case 9:
+        return QDate(2000, 1, 1).addDays(entropy.bounded(20000));
+    case 10:
+        return QTime(0, 0).addMSecs(entropy.bounded(86400000));
+    case 11:
+        return stringValue(entropy, corpus);
+    case 12:
+        return map(entropy, corpus, depth);
+    case 13:
+    {
+        QVariantHash hash;
+        const int count = entropy.bounded(corpus.maxChildren + 1);
+        for (int i = 0; i < count; ++i)
+            hash.insert(key(entropy, corpus), value(entropy, corpus, depth + 1));
+        return hash;
+    }
+    case 14:
+    {
+        QVariantList list;
+        const int count = entropy.bounded(corpus.maxChildren + 1);
+        for (int i = 0; i < count; ++i)
+            list.append(value(entropy, corpus, depth + 1));
+        return list;
+    }
+    default:
+    {
+        QStringList list;
+        const int count = entropy.bounded(corpus.maxChildren + 1);
+        for (int i = 0; i < count; ++i)
+            list.append(stringValue(entropy, corpus));
+        return list;
+    }
+    }
+}
+
+// Same as quoteAndEscape() decides it
+inline bool looksNumeric(const QString &string)
+{
+    static QRegExp rx(QLatin1String("^[+\\-]?[0-9]+(\\.[0-9]+)?$"));
+    return rx.exactMatch(string);
+}
+
+// Strings whose serialization isn't valid JSON
+inline bool isQuirk(const QString &string, bool isKey)
+{
+    if (looksNumeric(string)) {
+        // Written unquoted, which is only valid for values
+        // and only without a plus sign or leading zeros
+        static QRegExp canonical(QLatin1String("^-?(0|[1-9][0-9]*)(\\.[0-9]+)?$"));
+        return isKey || !canonical.exactMatch(string);
+    }
+
+    foreach (uint c, string.toUcs4()) {
+        // Unescaped control characters, and noncharacters that
+        // QJsonDocument doesn't accept
+        if (c < 0x20 && c != '\b' && c != '\f' && c != '\n' && c != '\r' && c != '\t')
+            return true;
+        if (QChar::isNonCharacter(c))
+            return true;
+    }
+    return false;
+}
+
+inline bool hasQuirks(const QVariant &value)
+{
+    switch (value.type()) {
+    case QVariant::String:
+    case QVariant::Char:
+    case QVariant::Url:
+        return isQuirk(value.toString(), false);
+    case QVariant::Map:
+    {
+        const QVariantMap map = value.toMap();
+        for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+            if (isQuirk(it.key(), true) || hasQuirks(it.value()))
+                return true;
+        }
+        return false;
+    }
+    case QVariant::Hash:
+    {
+        const QVariantHash hash = value.toHash();
+        for (QVariantHash::const_iterator it = hash.constBegin(); it != hash.constEnd(); ++it) {
+            if (isQuirk(it.key(), true) || hasQuirks(it.value()))
+                return true;
+        }
+        return false;
+    }
+    case QVariant::List:
+        foreach (const QVariant &item, value.toList()) {
+            if (hasQuirks(item))
+                return true;
+        }
+        return false;
+    case QVariant::StringList:
+        foreach (const QString &item, value.toStringList()) {
+            if (isQuirk(item, false))
+                return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+inline QJsonValue expectedString(const QString &string)
+{
+    // Numeric-looking strings are written as numbers
+    if (looksNumeric(string))
+        return QJsonValue(string.toDouble());
+    return QJsonValue(string);
+}
+
+// What QJsonDocument is expected to parse from the serialized value
+inline QJsonValue expected(const QVariant &value)
+{
+    switch (value.type()) {
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::Double:
+        return QJsonValue(value.toDouble());
+    case QVariant::Bool:
+        return QJsonValue(value.toBool());
+    case QVariant::String:
+    case QVariant::Char:
+    case QVariant::Url:
+        return expectedString(value.toString());
+    case QVariant::Date:
+        return expectedString(value.toDate().toString(Qt::ISODate));
+    case QVariant::Time:
+        return expectedString(value.toTime().toString(Qt::ISODate));
+    case QVariant::DateTime:
+        return expectedString(value.toDateTime().toUTC().toString(
+                                  QLatin1String("yyyy-MM-ddTHH:mm:ss.zzzZ")));
+    case QVariant::Map:
+    {
+        QJsonObject object;
+        const QVariantMap map = value.toMap();
+        for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it)
+            object.insert(it.key(), expected(it.value()));
+        return object;
+    }
+    case QVariant::Hash:
+    {
+        QJsonObject object;
+        const QVariantHash hash = value.toHash();
+        for (QVariantHash::const_iterator it = hash.constBegin(); it != hash.constEnd(); ++it)
+            object.insert(it.key(), expected(it.value()));
+        return object;
+    }
+    case QVariant::List:
+    {
+        QJsonArray array;
+        foreach (const QVariant &item, value.toList())
+            array.append(expected(item));
+        return array;
+    }
+    case QVariant::StringList:
+    {
+        QJsonArray array;
+        foreach (const QString &item, value.toStringList())
+            array.append(expectedString(item));
+        return array;
+    }
+    default:
+        return QJsonValue(QJsonValue::Null);
+    }
+}
+
+// Numbers are compared with a relative tolerance, as doubles are
+// written with limited precision and large integers become doubles
+inline bool sameJson(const QJsonValue &first, const QJsonValue &second)
+{
+    if (first.type() != second.type())
+        return false;
+
+    switch (first.type()) {
+    case QJsonValue::Double:
+    {
+        const double a = first.toDouble();
+        const double b = second.toDouble();
+        return a == b || std::fabs(a - b) <= 1e-12 * qMax(std::fabs(a), std::fabs(b));
+    }
+    case QJsonValue::Object:
+    {
+        const QJsonObject a = first.toObject();
+        const QJsonObject b = second.toObject();
+        if (a.count() != b.count())
+            return false;
+        for (QJsonObject::const_iterator it = a.constBegin(); it != a.constEnd(); ++it) {
+            if (!b.contains(it.key()) || !sameJson(it.value(), b.value(it.key())))
+                return false;
+        }
+        return true;
+    }
+    case QJsonValue::Array:
+    {
+        const QJsonArray a = first.toArray();
+        const QJsonArray b = second.toArray();
+        if (a.count() != b.count())
+            return false;
+        for (int i = 0; i < a.count(); ++i) {
+            if (!sameJson(a.at(i), b.at(i)))
+                return false;
+        }
+        return true;
+    }
+    default:
+        return first == second;
+    }
+}
+
+} // namespace VariantTree
+
+#endif // VARIANTTREE_H
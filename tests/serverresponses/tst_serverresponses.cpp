@@ -0,0 +1,309 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Tests how QAmplitudeAnalytics handles responses of the HTTP API
+// against a local stand-in server: throttling with Retry-After, too
+// large batches and rejected events, with and without their indexes in
+// the response. Pauses are skipped by advancing the request clock.
+
+#include "loopbackserver.h"
+
+#include <QAmplitudeAnalytics>
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocale>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QtTest>
+
+extern qint64 qamplitudeanalytics_requestClockSkew;
+
+// Answers with the queued responses first. After that, rejects requests
+// with events of the invalid types, like the HTTP API does for events
+// with invalid fields, and accepts the rest.
+class StandInServer: public LoopbackServer
+{
+public:
+    StandInServer(): reportIndexes(true) {}
+
+    QList<QByteArray> responses;
+    QStringList invalidEvents;
+    // Whether the index of the (first) invalid event is reported
+    bool reportIndexes;
+
+    // Event types of every request, and of the accepted ones
+    QList<QStringList> requests;
+    QStringList accepted;
+    // Bodies of every request
+    QList<QByteArray> bodies;
+
+    static QByteArray response(int status, const QByteArray &reason,
+                               const QByteArray &headers = QByteArray(),
+                               const QByteArray &body = QByteArray())
+    {
+        return "HTTP/1.1 " + QByteArray::number(status) + " " + reason + "\r\n" + headers
+               + "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+    }
+
+protected:
+    QByteArray response(const QByteArray &body)
+    {
+        bodies.append(body);
+        const QStringList events = eventTypes(body);
+        requests.append(events);
+        if (!responses.isEmpty())
+            return responses.takeFirst();
+
+        int invalid = 0;
+        while (invalid < events.count() && !invalidEvents.contains(events.at(invalid)))
+            ++invalid;
+        if (invalid == events.count()) {
+            accepted += events;
+            return success();
+        }
+
+        QByteArray json = "{\"code\":400,\"error\":\"Invalid field values on some events\"";
+        if (reportIndexes) {
+            json += ",\"events_with_invalid_fields\":{\"event_type\":["
+                    + QByteArray::number(invalid) + "]}";
+        }
+        json += "}";
+        return response(400, "Bad Request", "Content-Type: application/json\r\n", json);
+    }
+
+private:
+    static QStringList eventTypes(const QByteArray &body)
+    {
+        QStringList types;
+        foreach (const QByteArray &field, body.split('&')) {
+            if (!field.startsWith("event="))
+                continue;
+            const QJsonArray events = QJsonDocument::fromJson(
+                        QByteArray::fromPercentEncoding(field.mid(6))).array();
+            foreach (const QJsonValue &event, events)
+                types.append(event.toObject().value(QLatin1String("event_type")).toString());
+        }
+        return types;
+    }
+};
+
+class ServerResponsesTest: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void retryAfterSeconds();
+    void retryAfterDate();
+    void rejectedEventIndexes();
+    void rejectedEventsKept();
+    void tooLargeBatch();
+    void identifyWithDelta();
+
+private:
+    QTemporaryDir *m_dir;
+    StandInServer *m_server;
+    QAmplitudeAnalytics *m_analytics;
+
+    void track(const QStringList &eventTypes);
+    void skip(qint64 msecs);
+    QVariantMap destinationMetrics() const;
+    bool isDrained() const;
+};
+
+void ServerResponsesTest::init()
+{
+    qamplitudeanalytics_requestClockSkew = 0;
+    m_dir = new QTemporaryDir();
+    QVERIFY(m_dir->isValid());
+    m_server = new StandInServer();
+    QVERIFY(m_server->listen(0));
+
+    m_analytics = new QAmplitudeAnalytics(QLatin1String("key"),
+                                          QDir(m_dir->path()).filePath(QLatin1String("test.ini")));
+    m_analytics->setServerUrl(QUrl(QString::fromLatin1("http://127.0.0.1:%1/httpapi")
+                                   .arg(m_server->port())));
+    m_analytics->setUploadPolicy(QAmplitudeAnalytics::UploadAlways);
+    m_analytics->setSessionEventsEnabled(false);
+}
+
+void ServerResponsesTest::cleanup()
+{
+    delete m_analytics;
+    delete m_server;
+    delete m_dir;
+}
+
+void ServerResponsesTest::retryAfterSeconds()
+{
+    m_server->responses << StandInServer::response(429, "Too Many Requests",
+                                                   "Retry-After: 2\r\n");
+    m_analytics->trackEvent(QLatin1String("a"));
+    QTRY_COMPARE(m_server->requests.count(), 1);
+    QTRY_COMPARE(m_analytics->metrics().value(QLatin1String("requestsInFlight")).toInt(), 0);
+
+    skip(1900);
+    QCOMPARE(m_analytics->metrics().value(QLatin1String("requestsInFlight")).toInt(), 0);
+    skip(200);
+    QCOMPARE(m_analytics->metrics().value(QLatin1String("requestsInFlight")).toInt(), 1);
+    QTRY_VERIFY(isDrained());
+    QCOMPARE(m_server->requests.count(), 2);
+    QCOMPARE(m_server->accepted, QStringList() << QLatin1String("a"));
+}
+
+void ServerResponsesTest::retryAfterDate()
+{
+    const QDateTime retry = QDateTime::currentDateTimeUtc().addSecs(3);
+    const QByteArray date = QLocale::c().toString(
+                retry, QLatin1String("ddd, dd MMM yyyy HH:mm:ss 'GMT'")).toLatin1();
+    m_server->responses << StandInServer::response(503, "Service Unavailable",
+                                                   "Retry-After: " + date + "\r\n");
+    m_analytics->trackEvent(QLatin1String("a"));
+    QTRY_COMPARE(m_server->requests.count(), 1);
+    QTRY_COMPARE(m_analytics->metrics().value(QLatin1String("requestsInFlight")).toInt(), 0);
+
+    // More than 2 seconds, as the date has no fractions of a second
+    skip(1900);
+    QCOMPARE(m_analytics->metrics().value(QLatin1String("requestsInFlight")).toInt(), 0);
+    skip(1200);
+    QTRY_VERIFY(isDrained());
+    QCOMPARE(m_server->requests.count(), 2);
+    QCOMPARE(m_server->accepted, QStringList() << QLatin1String("a"));
+}
+
+void ServerResponsesTest::rejectedEventIndexes()
+{
+    // Only the first invalid event of a request is reported, so when c
+    // is reported, b has already been rejected and isn't sent anymore:
+    // c is at index 1 of the request, but at 2 in the queue
+    m_server->invalidEvents << QLatin1String("b") << QLatin1String("c");
+    track(QStringList() << QLatin1String("a") << QLatin1String("b")
+                        << QLatin1String("c") << QLatin1String("d"));
+
+    QTRY_VERIFY(isDrained());
+    QCOMPARE(m_server->requests, QList<QStringList>()
+             << (QStringList() << QLatin1String("a") << QLatin1String("b")
+                               << QLatin1String("c") << QLatin1String("d"))
+             << (QStringList() << QLatin1String("a") << QLatin1String("c")
+                               << QLatin1String("d"))
+             << (QStringList() << QLatin1String("a") << QLatin1String("d")));
+    QCOMPARE(m_server->accepted, QStringList() << QLatin1String("a") << QLatin1String("d"));
+    QCOMPARE(m_analytics->metrics().value(QLatin1String("rejectedEvents")).toInt(), 2);
+}
+
+void ServerResponsesTest::rejectedEventsKept()
+{
+    // Without indexes, nothing is dropped and sending is paused
+    m_server->reportIndexes = false;
+    m_server->invalidEvents << QLatin1String("b");
+    track(QStringList() << QLatin1String("a") << QLatin1String("b")
+                        << QLatin1String("c") << QLatin1String("d"));
+    QTRY_COMPARE(m_server->requests.count(), 1);
+    QTRY_COMPARE(m_analytics->metrics().value(QLatin1String("requestsInFlight")).toInt(), 0);
+    QCOMPARE(destinationMetrics().value(QLatin1String("queuedEvents")).toInt(), 4);
+    QCOMPARE(m_analytics->metrics().value(QLatin1String("rejectedEvents")).toInt(), 0);
+
+    m_server->invalidEvents.clear();
+    skip(29000);
+    QCOMPARE(m_analytics->metrics().value(QLatin1String("requestsInFlight")).toInt(), 0);
+    skip(2000);
+    QTRY_VERIFY(isDrained());
+    QCOMPARE(m_server->requests.count(), 2);
+    QCOMPARE(m_server->accepted, QStringList() << QLatin1String("a") << QLatin1String("b")
+                                               << QLatin1String("c") << QLatin1String("d"));
+}
+
+void ServerResponsesTest::tooLargeBatch()
+{
+    // Sent again right away, with smaller batches
+    m_server->responses << StandInServer::response(413, "Payload Too Large");
+    const int batchBytes = destinationMetrics().value(QLatin1String("batchBytes")).toInt();
+    track(QStringList() << QLatin1String("a") << QLatin1String("b"));
+
+    QTRY_VERIFY(isDrained());
+    QCOMPARE(m_server->requests.count(), 2);
+    QCOMPARE(m_server->accepted, QStringList() << QLatin1String("a") << QLatin1String("b"));
+    QVERIFY(destinationMetrics().value(QLatin1String("batchBytes")).toInt() < batchBytes);
+}
+
+void ServerResponsesTest::identifyWithDelta()
+{
+    // Only events leave out the user properties in delta mode
+    m_analytics->setUserPropertiesDeltaEnabled(true);
+    QVariantMap properties;
+    properties.insert(QLatin1String("plan"), QLatin1String("pro"));
+    m_analytics->identifyUser(properties);
+    QTRY_COMPARE(m_server->bodies.count(), 1);
+
+    QJsonObject identification;
+    foreach (const QByteArray &field, m_server->bodies.first().split('&')) {
+        if (field.startsWith("identification=")) {
+            identification = QJsonDocument::fromJson(
+                        QByteArray::fromPercentEncoding(field.mid(15))).object();
+        }
+    }
+    QCOMPARE(identification.value(QLatin1String("user_properties")).toObject()
+             .value(QLatin1String("plan")).toString(), QString::fromLatin1("pro"));
+}
+
+void ServerResponsesTest::track(const QStringList &eventTypes)
+{
+    // Sent together in one request
+    foreach (const QString &eventType, eventTypes)
+        m_analytics->trackEvent(eventType, QVariantMap(), true);
+    m_analytics->sendQueuedEvents();
+}
+
+void ServerResponsesTest::skip(qint64 msecs)
+{
+    qamplitudeanalytics_requestClockSkew += msecs;
+    QMetaObject::invokeMethod(m_analytics, "onRequestTimer");
+}
+
+QVariantMap ServerResponsesTest::destinationMetrics() const
+{
+    return m_analytics->metrics().value(QLatin1String("destinations")).toList().value(0).toMap();
+}
+
+bool ServerResponsesTest::isDrained() const
+{
+    const QVariantMap metrics = m_analytics->metrics();
+    foreach (const QVariant &destination, metrics.value(QLatin1String("destinations")).toList()) {
+        if (destination.toMap().value(QLatin1String("queuedEvents")).toInt() > 0)
+            return false;
+    }
+    return metrics.value(QLatin1String("requestsInFlight")).toInt() == 0;
+}
+
+QTEST_GUILESS_MAIN(ServerResponsesTest)
+
+#include "tst_serverresponses.moc"
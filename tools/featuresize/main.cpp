@@ -0,0 +1,67 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Starts QAmplitudeAnalytics the way an application does and reports
+// how long it took, for comparing build configurations (see report.sh).
+// Prints the time to construct QCoreApplication, QAmplitudeAnalytics and
+// to track the first event, in microseconds.
+
+#include <QAmplitudeAnalytics>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+int main(int argc, char *argv[])
+{
+    QElapsedTimer timer;
+    timer.start();
+    QCoreApplication app(argc, argv);
+    const qint64 application = timer.nsecsElapsed();
+
+    QTemporaryDir dir;
+    if (!dir.isValid())
+        return 1;
+
+    qint64 constructed;
+    qint64 tracked;
+    {
+        timer.start();
+        QAmplitudeAnalytics analytics(QLatin1String("featuresize"),
+                                      QDir(dir.path()).filePath(QLatin1String("featuresize.ini")));
+        constructed = timer.nsecsElapsed();
+        analytics.trackEvent(QLatin1String("Start"), QVariantMap(), true);
+        tracked = timer.nsecsElapsed() - constructed;
+    }
+
+    QTextStream out(stdout);
+    out << application / 1000 << " " << constructed / 1000 << " " << tracked / 1000 << "\n";
+    return 0;
+}
@@ -0,0 +1,91 @@
+#!/bin/sh
+##################################################################################
+#
+#  Qt In-App Analytics
+#
+#  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#
+#  * Redistributions of source code must retain the above copyright notice, this
+#    list of conditions and the following disclaimer.
+#
+#  * Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+#  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+#  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+#  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+#  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+#  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+#  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+#  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+##################################################################################
+
+# Builds a minimal application using the library with every option that
+# leaves a subsystem out (and with all of them), and reports binary size
+# and startup time of each:
+#
+#   ./report.sh [qmake]
+#
+# Size is that of the stripped binary, and text/data/bss as reported by
+# size(1). Startup times are medians of several runs, in microseconds:
+# process (including loading and static initialization), constructing
+# QAmplitudeAnalytics and tracking the first event.
+
+qmake=${1:-qmake}
+runs=${REPORT_RUNS:-11}
+source=$(cd "$(dirname "$0")" && pwd)
+build=$(mktemp -d)
+trap 'rm -rf "${build:?}"' EXIT
+
+# Median of numbers on standard input
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+printf '%-26s %10s %10s %8s %8s %10s %12s %10s\n' "Configuration" "Stripped" "Text" "Data" \
+    "Bss" "Process" "Construct" "Track"
+options="amplitude_no_persistence amplitude_no_mccmnc amplitude_no_location
+         amplitude_no_identify amplitude_no_metrics"
+all=$(echo $options)
+for config in "" $options "$all"; do
+    name=${config:-full}
+    [ "$config" = "$all" ] && name=all
+    dir="$build/$name"
+    mkdir -p "$dir"
+    if ! (cd "$dir" && "$qmake" "CONFIG+=release $config" "$source/featuresize.pro" >/dev/null \
+          && make -j"$(nproc 2>/dev/null || echo 2)" >/dev/null); then
+        echo "Building $name failed" >&2
+        exit 1
+    fi
+
+    binary="$dir/amplitudefeaturesize"
+    strip -o "$dir/stripped" "$binary"
+    stripped=$(wc -c < "$dir/stripped")
+    set -- $(size "$binary" | tail -n 1)
+    text=$1 data=$2 bss=$3
+
+    : > "$dir/times"
+    i=0
+    while [ $i -lt "$runs" ]; do
+        start=$(date +%s%N)
+        times=$("$binary")
+        end=$(date +%s%N)
+        echo "$(( (end - start) / 1000 )) $times" >> "$dir/times"
+        i=$((i + 1))
+    done
+    process=$(cut -d ' ' -f 1 "$dir/times" | median)
+    construct=$(cut -d ' ' -f 3 "$dir/times" | median)
+    track=$(cut -d ' ' -f 4 "$dir/times" | median)
+
+    printf '%-26s %10s %10s %8s %8s %10s %12s %10s\n' "$name" "$stripped" "$text" "$data" \
+        "$bss" "$process" "$construct" "$track"
+done
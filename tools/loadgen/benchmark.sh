@@ -0,0 +1,83 @@
+#!/bin/sh
+##################################################################################
+#
+#  Qt In-App Analytics
+#
+#  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#
+#  * Redistributions of source code must retain the above copyright notice, this
+#    list of conditions and the following disclaimer.
+#
+#  * Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+#  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+#  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+#  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+#  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+#  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+#  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+#  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+##################################################################################
+
+# Measures how many events per second trackEvent() handles in every
+# persistence mode, with the queues in each of the given directories
+# (e.g. one on ext4 and one on tmpfs):
+#
+#   ./benchmark.sh ./amplitudeloadgen ~/loadgen /dev/shm/loadgen
+#
+# Events are tracked as fast as possible by a single thread against the
+# loopback server of the load generator. Then, with the server dropping
+# every request so that the queue grows, compares the CPU time per event
+# and queue size with and without compression.
+#
+# It hasn't been run yet, so the persistence modes and compression have
+# no measured results so far.
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <amplitudeloadgen> <dir>..." >&2
+    exit 1
+fi
+
+loadgen=$1
+shift
+
+seconds=${BENCHMARK_SECONDS:-10}
+
+printf '%-14s %-30s %s\n' "Mode" "Directory" "Result"
+for dir in "$@"; do
+    for mode in immediately periodically on-exit; do
+        queues="${dir:?}/$mode"
+        rm -rf "${queues:?}"
+        mkdir -p "$queues"
+        # The first report covers the whole run
+        result=$("$loadgen" --threads 1 --rate 10000000 --dir "$queues" \
+                    --persistence "$mode" --duration $((seconds + 1)) \
+                    --report-interval "$seconds" | grep -m 1 ' s: tracked ' \
+                 | sed 's/^[0-9]* s: //')
+        printf '%-14s %-30s %s\n' "$mode" "$dir" "$result"
+        rm -rf "${queues:?}"
+    done
+done
+
+echo
+printf '%-14s %s\n' "Compression" "Result"
+for compression in "" --compression; do
+    queues="${1:?}/compression"
+    rm -rf "${queues:?}"
+    mkdir -p "$queues"
+    result=$("$loadgen" --threads 1 --rate 2000 --dir "$queues" --drop-rate 1 \
+                $compression --duration $((seconds + 1)) --report-interval "$seconds" \
+             | grep -m 1 ' s: tracked ' | sed 's/^[0-9]* s: //')
+    printf '%-14s %s\n' "${compression:-none}" "$result"
+    rm -rf "${queues:?}"
+done
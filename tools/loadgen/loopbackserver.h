@@ -0,0 +1,245 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOOPBACKSERVER_H
+#define LOOPBACKSERVER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+// Minimal HTTP/1.1 server that accepts uploads like the HTTP API does.
+// Every request is answered by response(), which reimplementations can
+// use to script answers. By default, requests succeed unless faults are
+// injected: dropped connections, throttling (429) and delayed responses.
+class LoopbackServer: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LoopbackServer(QObject *parent = 0)
+        : QObject(parent)
+        , m_port(0)
+        , m_dropRate(0)
+        , m_throttleRate(0)
+        , m_delay(0)
+        , m_random(quint32(QDateTime::currentMSecsSinceEpoch()) | 1)
+        , m_received(0)
+        , m_dropped(0)
+        , m_throttled(0)
+    {
+        m_clock.start();
+        m_responseTimer.setInterval(5);
+        connect(&m_server, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+        connect(&m_responseTimer, SIGNAL(timeout()), this, SLOT(onResponseTimer()));
+    }
+
+    // Shares of requests whose connection is dropped or that are throttled
+    void setDropRate(qreal rate) { m_dropRate = rate; }
+    void setThrottleRate(qreal rate) { m_throttleRate = rate; }
+    // Delay of every response in milliseconds
+    void setDelay(int msecs) { m_delay = msecs; }
+
+    // Listens on localhost, on any free port if port is 0
+    bool listen(quint16 port)
+    {
+        if (!m_server.listen(QHostAddress::LocalHost, port))
+            return false;
+        m_port = m_server.serverPort();
+        return true;
+    }
+
+    QString errorString() const { return m_server.errorString(); }
+    quint16 port() const { return m_port; }
+
+    // Since the last call. Received events are those of successful
+    // requests, every event is expected to have an insert_id.
+    void takeCounts(qint64 *received, qint64 *dropped, qint64 *throttled)
+    {
+        *received = m_received;
+        *dropped = m_dropped;
+        *throttled = m_throttled;
+        m_received = m_dropped = m_throttled = 0;
+    }
+
+public slots:
+    // Stops accepting connections and drops open ones
+    void goOffline()
+    {
+        m_server.close();
+        foreach (QTcpSocket *socket, m_buffers.keys())
+            socket->abort();
+    }
+
+    void goOnline()
+    {
+        listen(m_port);
+    }
+
+protected:
+    // Raw HTTP response to a request with the given (form encoded) body,
+    // an empty one to drop the connection
+    virtual QByteArray response(const QByteArray &body)
+    {
+        const qreal fault = randomReal();
+        if (fault < m_dropRate) {
+            ++m_dropped;
+            return QByteArray();
+        }
+        if (fault < m_dropRate + m_throttleRate) {
+            ++m_throttled;
+            return "HTTP/1.1 429 Too Many Requests\r\n"
+                   "Retry-After: 1\r\nContent-Length: 0\r\n\r\n";
+        }
+
+        m_received += body.count("insert_id");
+        return success();
+    }
+
+    static QByteArray success()
+    {
+        return "HTTP/1.1 200 OK\r\n"
+               "Content-Type: text/plain\r\nContent-Length: 7\r\n\r\nsuccess";
+    }
+
+    // In [0, 1), xorshift32
+    qreal randomReal()
+    {
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 17;
+        m_random ^= m_random << 5;
+        return m_random / 4294967296.0;
+    }
+
+private slots:
+    void onNewConnection()
+    {
+        while (QTcpSocket *socket = m_server.nextPendingConnection()) {
+            m_buffers.insert(socket, QByteArray());
+            connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+            connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+        }
+    }
+
+    void onReadyRead()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+        if (!socket || !m_buffers.contains(socket))
+            return;
+
+        m_buffers[socket].append(socket->readAll());
+        while (m_buffers.contains(socket)) {
+            QByteArray &buffer = m_buffers[socket];
+            const int headerEnd = buffer.indexOf("\r\n\r\n");
+            if (headerEnd < 0)
+                return;
+
+            int contentLength = 0;
+            foreach (const QByteArray &line, buffer.left(headerEnd).split('\n')) {
+                const int colon = line.indexOf(':');
+                if (colon > 0 && line.left(colon).trimmed().toLower() == "content-length")
+                    contentLength = line.mid(colon + 1).trimmed().toInt();
+            }
+            if (buffer.size() < headerEnd + 4 + contentLength)
+                return;
+
+            const QByteArray body = buffer.mid(headerEnd + 4, contentLength);
+            buffer.remove(0, headerEnd + 4 + contentLength);
+            handleRequest(socket, body);
+        }
+    }
+
+    void onDisconnected()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+        m_buffers.remove(socket);
+        if (socket)
+            socket->deleteLater();
+    }
+
+    void onResponseTimer()
+    {
+        const qint64 now = m_clock.elapsed();
+        while (!m_responses.isEmpty() && m_responses.first().due <= now) {
+            const Response response = m_responses.takeFirst();
+            if (response.socket)
+                response.socket->write(response.data);
+        }
+        if (m_responses.isEmpty())
+            m_responseTimer.stop();
+    }
+
+private:
+    struct Response {
+        QPointer<QTcpSocket> socket;
+        QByteArray data;
+        qint64 due;
+    };
+
+    QTcpServer m_server;
+    quint16 m_port;
+    qreal m_dropRate;
+    qreal m_throttleRate;
+    int m_delay;
+    quint32 m_random;
+    QHash<QTcpSocket *, QByteArray> m_buffers;
+    QList<Response> m_responses;
+    QTimer m_responseTimer;
+    QElapsedTimer m_clock;
+    qint64 m_received;
+    qint64 m_dropped;
+    qint64 m_throttled;
+
+    void handleRequest(QTcpSocket *socket, const QByteArray &body)
+    {
+        Response response;
+        response.socket = socket;
+        response.data = this->response(body);
+        response.due = m_clock.elapsed() + m_delay;
+        if (response.data.isEmpty()) {
+            socket->abort();
+            return;
+        }
+
+        if (m_delay <= 0) {
+            socket->write(response.data);
+            return;
+        }
+        m_responses.append(response);
+        if (!m_responseTimer.isActive())
+            m_responseTimer.start();
+    }
+};
+
+#endif // LOOPBACKSERVER_H
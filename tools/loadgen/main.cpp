@@ -0,0 +1,752 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Load generator for QAmplitudeAnalytics. Every thread tracks events
+// through its own QAmplitudeAnalytics instance (and its own queue) at a
+// given rate, uploading to a loopback HTTP server in this process.
+// Periodically reports the event rate, trackEvent() latency, CPU time
+// per event, resident memory and size of the queues on disk (and their
+// compression ratio).
+//
+// Faults that can be injected:
+//  * network loss - dropped connections, throttling (429) and outages
+//    during which the server doesn't accept connections;
+//  * slow disk - with --disk-load, a thread keeps writing and syncing
+//    a ballast file next to the queues, competing with them for the
+//    disk (pointing --dir to slow storage, e.g. a dm-delay device,
+//    works too);
+//  * process kill and restart - with --kill-interval, the load runs in
+//    a child process that is killed (SIGKILL on Unix) and restarted,
+//    while the server keeps running in the parent.
+
+#include "loopbackserver.h"
+
+#include <QAmplitudeAnalytics>
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QProcess>
+#include <QScopedPointer>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#   include <time.h>
+#   include <unistd.h>
+#endif
+
+namespace {
+
+struct Options {
+    int threads;
+    qreal rate;
+    int eventTypes;
+    int properties;
+    int valueSize;
+    int duration;
+    int reportInterval;
+    QString dir;
+    QAmplitudeAnalytics::PersistenceMode persistence;
+    bool compression;
+    qreal dropRate;
+    qreal throttleRate;
+    int serverDelay;
+    int outageInterval;
+    int outageDuration;
+    int killInterval;
+    quint16 serverPort;
+    qreal diskLoad;
+};
+
+// Longest time a worker spends tracking events without returning to
+// the event loop, in milliseconds
+const int MaxBusyTime = 50;
+
+// Disk load is written in chunks of this size, wrapping around at the
+// maximum size of the ballast file
+const int DiskLoadChunk = 256 * 1024;
+const qint64 DiskLoadFileSize = 64 * 1024 * 1024;
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+// xorshift32, so that threads don't share (or race on) the state of
+// the C library generator
+class Random
+{
+public:
+    explicit Random(quint32 seed): m_state(seed | 1) {}
+
+    quint32 next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+
+    // In [0, n)
+    int bounded(int n) { return int(next() % quint32(n)); }
+    // In [0, 1)
+    qreal real() { return next() / 4294967296.0; }
+
+private:
+    quint32 m_state;
+};
+
+// In bytes, -1 where it isn't known
+qint64 residentSize()
+{
+#ifdef Q_OS_UNIX
+    QFile file(QLatin1String("/proc/self/statm"));
+    if (file.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> fields = file.readAll().split(' ');
+        if (fields.count() > 1)
+            return fields.at(1).toLongLong() * ::sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return -1;
+}
+
+// CPU time used by the calling thread in nanoseconds, -1 where it isn't known
+qint64 threadCpuTime()
+{
+#if defined(Q_OS_UNIX) && defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0)
+        return qint64(time.tv_sec) * 1000000000 + time.tv_nsec;
+#endif
+    return -1;
+}
+
+qint64 directorySize(const QString &path)
+{
+    qint64 size = 0;
+    QDirIterator it(path, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        size += it.fileInfo().size();
+    }
+    return size;
+}
+
+QString ballastFileName(const QString &dir)
+{
+    return QDir(dir).filePath(QLatin1String("disk-load.ballast"));
+}
+
+QString toMiB(qint64 bytes)
+{
+    return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + QLatin1String(" MiB");
+}
+
+// Of sorted latencies, in microseconds
+QString percentile(const QVector<qint64> &latencies, qreal p)
+{
+    if (latencies.isEmpty())
+        return QLatin1String("-");
+    const int index = qMin(latencies.count() - 1, int(p * latencies.count()));
+    return QString::number(latencies.at(index) / 1000.0, 'f', 1);
+}
+
+} // namespace
+
+// Writes a ballast file at the given rate, syncing every chunk, so that
+// writes and syncs of the queues wait for the disk behind it
+class DiskLoad: public QThread
+{
+public:
+    DiskLoad(const QString &fileName, qreal mibPerSecond)
+        : m_fileName(fileName)
+        , m_rate(mibPerSecond)
+    {}
+
+    ~DiskLoad()
+    {
+        m_stopped.storeRelease(1);
+        wait();
+        QFile::remove(m_fileName);
+    }
+
+protected:
+    void run()
+    {
+        QFile file(m_fileName);
+        if (!file.open(QFile::ReadWrite | QFile::Truncate)) {
+            qWarning() << "Failed to open" << m_fileName << file.errorString();
+            return;
+        }
+
+        const QByteArray chunk(DiskLoadChunk, 'x');
+        QElapsedTimer elapsed;
+        elapsed.start();
+        qint64 written = 0;
+        while (!m_stopped.loadAcquire()) {
+            if (written >= qint64(m_rate * 1024 * 1024 * elapsed.elapsed() / 1000)) {
+                msleep(5);
+                continue;
+            }
+
+            if (file.pos() + chunk.size() > DiskLoadFileSize)
+                file.seek(0);
+            if (file.write(chunk) != chunk.size() || !file.flush()) {
+                qWarning() << "Failed to write" << m_fileName << file.errorString();
+                return;
+            }
+#if defined(Q_OS_LINUX)
+            ::fdatasync(file.handle());
+#elif defined(Q_OS_UNIX)
+            ::fsync(file.handle());
+#endif
+            written += chunk.size();
+        }
+    }
+
+private:
+    QString m_fileName;
+    qreal m_rate;
+    QAtomicInt m_stopped;
+};
+
+// Tracks events at the given rate through its own QAmplitudeAnalytics.
+// Lives in its own thread, takeSamples() may be called from any thread.
+class Worker: public QObject
+{
+    Q_OBJECT
+
+public:
+    Worker(int id, const Options &options, const QUrl &serverUrl)
+        : m_id(id)
+        , m_options(options)
+        , m_serverUrl(serverUrl)
+        , m_random(quint32(id) * 7919 + quint32(QDateTime::currentMSecsSinceEpoch()))
+        , m_analytics(0)
+        , m_timer(0)
+        , m_generated(0)
+        , m_events(0)
+        , m_cpuTime(-1)
+        , m_reportedCpuTime(0)
+        , m_compressionRatio(0)
+    {}
+
+    QString configFilePath() const
+    {
+        return QDir(m_options.dir).filePath(QString::fromLatin1("worker-%1.ini").arg(m_id));
+    }
+
+    QString queuePath() const
+    {
+        return QDir(m_options.dir).filePath(QString::fromLatin1("worker-%1.queue").arg(m_id));
+    }
+
+    // cpuTime is the CPU time used by the thread since the last call,
+    // including uploads
+    void takeSamples(QVector<qint64> *latencies, qint64 *events, qint64 *cpuTime,
+                     qreal *compressionRatio)
+    {
+        QMutexLocker locker(&m_mutex);
+        *latencies += m_latencies;
+        *events += m_events;
+        *cpuTime += qMax(Q_INT64_C(0), m_cpuTime - m_reportedCpuTime);
+        *compressionRatio = m_compressionRatio;
+        m_latencies.clear();
+        m_events = 0;
+        m_reportedCpuTime = m_cpuTime;
+    }
+
+public slots:
+    void start()
+    {
+        for (int i = 0; i < m_options.eventTypes; ++i)
+            m_eventTypes.append(QString::fromLatin1("Event %1").arg(i));
+        for (int i = 0; i < m_options.properties; ++i)
+            m_keys.append(QString::fromLatin1("property_%1").arg(i));
+        // Properties mostly have one of a few values
+        for (int i = 0; i < 50; ++i) {
+            QString value;
+            for (int j = 0; j < m_options.valueSize; ++j)
+                value.append(QLatin1Char('a' + m_random.bounded(26)));
+            m_values.append(value);
+        }
+
+        m_analytics = new QAmplitudeAnalytics(QLatin1String("loadgen"), configFilePath(), this);
+        m_analytics->setServerUrl(m_serverUrl);
+        m_analytics->setPersistenceMode(m_options.persistence);
+        m_analytics->setQueueCompressionEnabled(m_options.compression);
+
+        m_timer = new QTimer(this);
+        m_timer->setInterval(10);
+        connect(m_timer, SIGNAL(timeout()), this, SLOT(generate()));
+        m_elapsed.start();
+        m_timer->start();
+    }
+
+    void stop()
+    {
+        delete m_timer;
+        m_timer = 0;
+        // Persists the queue
+        delete m_analytics;
+        m_analytics = 0;
+    }
+
+private slots:
+    void generate()
+    {
+        const qint64 due = qint64(m_options.rate * m_elapsed.elapsed() / 1000) - m_generated;
+        // Return to the event loop now and then when the rate
+        // can't be reached, so that uploads and stop() get handled
+        QElapsedTimer busy;
+        busy.start();
+        QElapsedTimer timer;
+        qint64 i = 0;
+        for (; i < due && busy.elapsed() < MaxBusyTime; ++i) {
+            QVariantMap properties;
+            foreach (const QString &key, m_keys)
+                properties.insert(key, m_values.at(m_random.bounded(m_values.count())));
+            const QString &eventType = m_eventTypes.at(m_random.bounded(m_eventTypes.count()));
+
+            timer.start();
+            m_analytics->trackEvent(eventType, properties);
+            const qint64 latency = timer.nsecsElapsed();
+
+            QMutexLocker locker(&m_mutex);
+            m_latencies.append(latency);
+            ++m_events;
+        }
+        m_generated += i;
+
+        const qint64 cpuTime = threadCpuTime();
+        const QVariant ratio = m_analytics->metrics().value(QLatin1String("queueCompressionRatio"));
+        QMutexLocker locker(&m_mutex);
+        if (m_cpuTime < 0)
+            m_reportedCpuTime = cpuTime;
+        m_cpuTime = cpuTime;
+        m_compressionRatio = ratio.toReal();
+    }
+
+private:
+    int m_id;
+    Options m_options;
+    QUrl m_serverUrl;
+    Random m_random;
+    QAmplitudeAnalytics *m_analytics;
+    QTimer *m_timer;
+    QElapsedTimer m_elapsed;
+    qint64 m_generated;
+    QStringList m_eventTypes;
+    QStringList m_keys;
+    QStringList m_values;
+
+    QMutex m_mutex;
+    QVector<qint64> m_latencies;
+    qint64 m_events;
+    qint64 m_cpuTime;
+    qint64 m_reportedCpuTime;
+    qreal m_compressionRatio;
+};
+
+// Runs the workers and reports on them. Also runs the server,
+// unless it's running in the parent process.
+class LoadGenerator: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LoadGenerator(const Options &options, QObject *parent = 0)
+        : QObject(parent)
+        , m_options(options)
+        , m_server(0)
+        , m_startSize(-1)
+    {}
+
+    ~LoadGenerator()
+    {
+        for (int i = 0; i < m_workers.count(); ++i) {
+            QMetaObject::invokeMethod(m_workers.at(i), "stop", Qt::BlockingQueuedConnection);
+            m_threads.at(i)->quit();
+            m_threads.at(i)->wait();
+            delete m_workers.at(i);
+            delete m_threads.at(i);
+        }
+    }
+
+    bool start()
+    {
+        quint16 port = m_options.serverPort;
+        if (port == 0) {
+            m_server = new LoopbackServer(this);
+            m_server->setDropRate(m_options.dropRate);
+            m_server->setThrottleRate(m_options.throttleRate);
+            m_server->setDelay(m_options.serverDelay);
+            if (!m_server->listen(0)) {
+                out() << "Can't listen: " << m_server->errorString() << "\n";
+                return false;
+            }
+            port = m_server->port();
+
+            if (m_options.outageInterval > 0 && m_options.outageDuration > 0) {
+                QTimer *outages = new QTimer(this);
+                outages->setInterval(m_options.outageInterval * 1000);
+                connect(outages, SIGNAL(timeout()), this, SLOT(startOutage()));
+                outages->start();
+            }
+        }
+
+        const QUrl url(QString::fromLatin1("http://127.0.0.1:%1/httpapi").arg(port));
+        for (int i = 0; i < m_options.threads; ++i) {
+            QThread *thread = new QThread();
+            Worker *worker = new Worker(i, m_options, url);
+            worker->moveToThread(thread);
+            connect(thread, SIGNAL(started()), worker, SLOT(start()));
+            m_threads.append(thread);
+            m_workers.append(worker);
+            thread->start();
+        }
+
+        QTimer *reports = new QTimer(this);
+        reports->setInterval(m_options.reportInterval * 1000);
+        connect(reports, SIGNAL(timeout()), this, SLOT(report()));
+        reports->start();
+        m_elapsed.start();
+        m_interval.start();
+        return true;
+    }
+
+public slots:
+    void report()
+    {
+        const qreal seconds = qMax<qint64>(1, m_interval.restart()) / 1000.0;
+        QVector<qint64> latencies;
+        qint64 events = 0;
+        qint64 cpuTime = 0;
+        qreal compressionRatio = 0;
+        qint64 queueSize = 0;
+        foreach (Worker *worker, m_workers) {
+            qreal ratio = 0;
+            worker->takeSamples(&latencies, &events, &cpuTime, &ratio);
+            compressionRatio += ratio / m_workers.count();
+            queueSize += directorySize(worker->queuePath());
+        }
+        std::sort(latencies.begin(), latencies.end());
+
+        const qint64 rss = residentSize();
+        if (m_startSize < 0)
+            m_startSize = rss;
+
+        out() << m_elapsed.elapsed() / 1000 << " s: tracked " << qRound64(events / seconds)
+              << " events/s, trackEvent() p50 " << percentile(latencies, 0.5)
+              << " us, p99 " << percentile(latencies, 0.99)
+              << " us, p99.9 " << percentile(latencies, 0.999) << " us";
+        if (cpuTime > 0 && events > 0)
+            out() << ", CPU " << QString::number(cpuTime / 1000.0 / events, 'f', 1) << " us/event";
+        if (m_server) {
+            qint64 received, dropped, throttled;
+            m_server->takeCounts(&received, &dropped, &throttled);
+            out() << ", received " << qRound64(received / seconds) << " events/s ("
+                  << dropped << " requests dropped, " << throttled << " throttled)";
+        }
+        if (rss >= 0)
+            out() << ", RSS " << toMiB(rss) << " (+" << toMiB(rss - m_startSize) << ")";
+        out() << ", queues " << toMiB(queueSize);
+        if (compressionRatio > 0)
+            out() << " (compressed " << QString::number(compressionRatio, 'f', 1) << ":1)";
+        out() << "\n";
+        out().flush();
+    }
+
+private slots:
+    void startOutage()
+    {
+        out() << "Network outage for " << m_options.outageDuration << " s\n";
+        m_server->goOffline();
+        QTimer::singleShot(m_options.outageDuration * 1000, m_server, SLOT(goOnline()));
+    }
+
+private:
+    Options m_options;
+    LoopbackServer *m_server;
+    QList<QThread *> m_threads;
+    QList<Worker *> m_workers;
+    QElapsedTimer m_elapsed;
+    QElapsedTimer m_interval;
+    qint64 m_startSize;
+};
+
+// Runs the load in a child process and kills it now and then
+class Supervisor: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Supervisor(const Options &options, QObject *parent = 0)
+        : QObject(parent)
+        , m_options(options)
+        , m_server(this)
+        , m_random(quint32(QDateTime::currentMSecsSinceEpoch()))
+        , m_restarts(0)
+    {
+        m_server.setDropRate(options.dropRate);
+        m_server.setThrottleRate(options.throttleRate);
+        m_server.setDelay(options.serverDelay);
+        m_process.setProcessChannelMode(QProcess::ForwardedChannels);
+        m_killTimer.setSingleShot(true);
+        connect(&m_killTimer, SIGNAL(timeout()), this, SLOT(restart()));
+    }
+
+    ~Supervisor()
+    {
+        m_process.terminate();
+        if (!m_process.waitForFinished(10000))
+            m_process.kill();
+    }
+
+    bool start()
+    {
+        if (!m_server.listen(0)) {
+            out() << "Can't listen: " << m_server.errorString() << "\n";
+            return false;
+        }
+
+        if (m_options.outageInterval > 0 && m_options.outageDuration > 0) {
+            QTimer *outages = new QTimer(this);
+            outages->setInterval(m_options.outageInterval * 1000);
+            connect(outages, SIGNAL(timeout()), this, SLOT(startOutage()));
+            outages->start();
+        }
+
+        QTimer *reports = new QTimer(this);
+        reports->setInterval(m_options.reportInterval * 1000);
+        connect(reports, SIGNAL(timeout()), this, SLOT(report()));
+        reports->start();
+        m_elapsed.start();
+        m_interval.start();
+
+        startChild();
+        return true;
+    }
+
+private slots:
+    void restart()
+    {
+        m_process.kill();
+        m_process.waitForFinished();
+        ++m_restarts;
+        out() << "Killed the load generator, restarting\n";
+        startChild();
+    }
+
+    void report()
+    {
+        const qreal seconds = qMax<qint64>(1, m_interval.restart()) / 1000.0;
+        qint64 received, dropped, throttled;
+        m_server.takeCounts(&received, &dropped, &throttled);
+        out() << m_elapsed.elapsed() / 1000 << " s: received " << qRound64(received / seconds)
+              << " events/s (" << dropped << " requests dropped, " << throttled
+              << " throttled), " << m_restarts << " restarts, on disk "
+              << toMiB(directorySize(m_options.dir)
+                       - QFileInfo(ballastFileName(m_options.dir)).size()) << "\n";
+        out().flush();
+    }
+
+    void startOutage()
+    {
+        out() << "Network outage for " << m_options.outageDuration << " s\n";
+        m_server.goOffline();
+        QTimer::singleShot(m_options.outageDuration * 1000, &m_server, SLOT(goOnline()));
+    }
+
+private:
+    Options m_options;
+    LoopbackServer m_server;
+    Random m_random;
+    QProcess m_process;
+    QTimer m_killTimer;
+    QElapsedTimer m_elapsed;
+    QElapsedTimer m_interval;
+    int m_restarts;
+
+    void startChild()
+    {
+        // Options given last take precedence
+        QStringList arguments = QCoreApplication::arguments().mid(1);
+        arguments << QLatin1String("--kill-interval") << QLatin1String("0")
+                  << QLatin1String("--duration") << QLatin1String("0")
+                  << QLatin1String("--server-port") << QString::number(m_server.port())
+                  << QLatin1String("--dir") << m_options.dir
+                  << QLatin1String("--disk-load") << QLatin1String("0");
+        m_process.start(QCoreApplication::applicationFilePath(), arguments);
+
+        // Somewhere between half and one and a half of the interval
+        m_killTimer.start(int(m_options.killInterval * 1000 * (0.5 + m_random.real())));
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QLatin1String("amplitudeloadgen"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String("Load generator for QAmplitudeAnalytics."));
+    parser.addHelpOption();
+
+    QList<QCommandLineOption> options;
+    const QCommandLineOption threadsOption(QLatin1String("threads"),
+            QLatin1String("Threads tracking events."), QLatin1String("count"), QLatin1String("4"));
+    const QCommandLineOption rateOption(QLatin1String("rate"),
+            QLatin1String("Events per second, per thread."), QLatin1String("events"),
+            QLatin1String("100"));
+    const QCommandLineOption eventTypesOption(QLatin1String("event-types"),
+            QLatin1String("Distinct event types."), QLatin1String("count"), QLatin1String("20"));
+    const QCommandLineOption propertiesOption(QLatin1String("properties"),
+            QLatin1String("Event properties per event."), QLatin1String("count"),
+            QLatin1String("10"));
+    const QCommandLineOption valueSizeOption(QLatin1String("value-size"),
+            QLatin1String("Length of property values."), QLatin1String("chars"),
+            QLatin1String("16"));
+    const QCommandLineOption durationOption(QLatin1String("duration"),
+            QLatin1String("Stop after this many seconds, 0 to run until killed."),
+            QLatin1String("seconds"), QLatin1String("60"));
+    const QCommandLineOption reportOption(QLatin1String("report-interval"),
+            QLatin1String("Report every this many seconds."), QLatin1String("seconds"),
+            QLatin1String("10"));
+    const QCommandLineOption dirOption(QLatin1String("dir"),
+            QLatin1String("Directory for settings and queues."), QLatin1String("path"));
+    const QCommandLineOption persistenceOption(QLatin1String("persistence"),
+            QLatin1String("immediately, periodically or on-exit."), QLatin1String("mode"),
+            QLatin1String("periodically"));
+    const QCommandLineOption compressionOption(QLatin1String("compression"),
+            QLatin1String("Compress the queues."));
+    const QCommandLineOption dropRateOption(QLatin1String("drop-rate"),
+            QLatin1String("Share of requests whose connection is dropped."),
+            QLatin1String("ratio"), QLatin1String("0"));
+    const QCommandLineOption throttleRateOption(QLatin1String("throttle-rate"),
+            QLatin1String("Share of requests answered with 429."), QLatin1String("ratio"),
+            QLatin1String("0"));
+    const QCommandLineOption serverDelayOption(QLatin1String("server-delay"),
+            QLatin1String("Delay of every response."), QLatin1String("ms"), QLatin1String("0"));
+    const QCommandLineOption outageIntervalOption(QLatin1String("outage-interval"),
+            QLatin1String("Have a network outage every this many seconds."),
+            QLatin1String("seconds"), QLatin1String("0"));
+    const QCommandLineOption outageDurationOption(QLatin1String("outage-duration"),
+            QLatin1String("Length of network outages."), QLatin1String("seconds"),
+            QLatin1String("30"));
+    const QCommandLineOption killIntervalOption(QLatin1String("kill-interval"),
+            QLatin1String("Kill and restart the load generator about every this many seconds."),
+            QLatin1String("seconds"), QLatin1String("0"));
+    const QCommandLineOption serverPortOption(QLatin1String("server-port"),
+            QLatin1String("Upload to a server running on this port instead of starting one."),
+            QLatin1String("port"), QLatin1String("0"));
+    const QCommandLineOption diskLoadOption(QLatin1String("disk-load"),
+            QLatin1String("Write and sync this many MiB/s to a file in the directory of "
+                          "the queues, to slow down the disk."), QLatin1String("MiB/s"),
+            QLatin1String("0"));
+    options << threadsOption << rateOption << eventTypesOption << propertiesOption
+            << valueSizeOption << durationOption << reportOption << dirOption
+            << persistenceOption << compressionOption << dropRateOption << throttleRateOption
+            << serverDelayOption << outageIntervalOption << outageDurationOption
+            << killIntervalOption << serverPortOption << diskLoadOption;
+    foreach (const QCommandLineOption &option, options)
+        parser.addOption(option);
+    parser.process(app);
+
+    Options o;
+    o.threads = qMax(1, parser.value(threadsOption).toInt());
+    o.rate = qMax(qreal(0), qreal(parser.value(rateOption).toDouble()));
+    o.eventTypes = qMax(1, parser.value(eventTypesOption).toInt());
+    o.properties = qMax(0, parser.value(propertiesOption).toInt());
+    o.valueSize = qMax(1, parser.value(valueSizeOption).toInt());
+    o.duration = qMax(0, parser.value(durationOption).toInt());
+    o.reportInterval = qMax(1, parser.value(reportOption).toInt());
+    o.dir = parser.value(dirOption);
+    if (o.dir.isEmpty()) {
+        o.dir = QDir::temp().filePath(QString::fromLatin1("amplitudeloadgen-%1")
+                                      .arg(QCoreApplication::applicationPid()));
+    }
+    QDir().mkpath(o.dir);
+    const QString persistence = parser.value(persistenceOption);
+    o.persistence = QAmplitudeAnalytics::PersistPeriodically;
+    if (persistence == QLatin1String("immediately"))
+        o.persistence = QAmplitudeAnalytics::PersistImmediately;
+    else if (persistence == QLatin1String("on-exit"))
+        o.persistence = QAmplitudeAnalytics::PersistOnExit;
+    o.compression = parser.isSet(compressionOption);
+    o.dropRate = qBound(qreal(0), qreal(parser.value(dropRateOption).toDouble()), qreal(1));
+    o.throttleRate = qBound(qreal(0), qreal(parser.value(throttleRateOption).toDouble()), qreal(1));
+    o.serverDelay = qMax(0, parser.value(serverDelayOption).toInt());
+    o.outageInterval = qMax(0, parser.value(outageIntervalOption).toInt());
+    o.outageDuration = qMax(0, parser.value(outageDurationOption).toInt());
+    o.killInterval = qMax(0, parser.value(killIntervalOption).toInt());
+    o.serverPort = quint16(parser.value(serverPortOption).toUInt());
+    o.diskLoad = qMax(qreal(0), qreal(parser.value(diskLoadOption).toDouble()));
+
+    out() << "Queues in " << o.dir << "\n";
+    // Runs in the parent when the load runs in a child process
+    QScopedPointer<DiskLoad> diskLoad;
+    if (o.diskLoad > 0) {
+        out() << "Disk load " << o.diskLoad << " MiB/s\n";
+        diskLoad.reset(new DiskLoad(ballastFileName(o.dir), o.diskLoad));
+        diskLoad->start();
+    }
+    if (o.duration > 0)
+        QTimer::singleShot(o.duration * 1000, &app, SLOT(quit()));
+
+    if (o.killInterval > 0) {
+        Supervisor supervisor(o);
+        if (!supervisor.start())
+            return 1;
+        return app.exec();
+    }
+
+    LoadGenerator generator(o);
+    if (!generator.start())
+        return 1;
+    const int result = app.exec();
+    generator.report();
+    return result;
+}
+
+#include "main.moc"
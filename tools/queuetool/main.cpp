@@ -0,0 +1,348 @@
+/*
+ *  Qt In-App Analytics
+ *
+ *  Copyright (c) 2015-2018, Oleksii Serdiuk <contacts[at]oleksii[dot]name>
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Inspects the event queue of QAmplitudeAnalytics: prints statistics,
+// exports queued events as NDJSON or replays them against an endpoint.
+// Events are streamed from the queue, which is opened read-only: nothing
+// is committed and recovery doesn't truncate a torn tail or delete files.
+// The application still deletes segments once they are sent, so use it
+// on a copy or while the application isn't running.
+
+#include "eventqueue_p.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QTextStream>
+#include <QTimer>
+#include <QUrl>
+#include <QVector>
+
+#include <cstdio>
+
+namespace {
+
+// Events are read from the queue in chunks of at most this size
+const int ChunkEvents = 1000;
+const qint64 ChunkBytes = 1024 * 1024;
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+int printStats(QAmplitudeEventQueue &queue, const QString &reader)
+{
+    QMap<QString, qint64> types;
+    // Event sizes, by power of two
+    QVector<qint64> sizes(32, 0);
+    qint64 count = 0;
+    qint64 bytes = 0;
+    qint64 invalid = 0;
+    qint64 oldest = -1;
+    qint64 newest = -1;
+
+    forever {
+        const QList<QByteArray> events = queue.read(reader, ChunkEvents, ChunkBytes);
+        if (events.isEmpty())
+            break;
+
+        foreach (const QByteArray &event, events) {
+            ++count;
+            bytes += event.size();
+            int bucket = 0;
+            while (bucket < sizes.count() - 1 && (Q_INT64_C(1) << bucket) < event.size())
+                ++bucket;
+            ++sizes[bucket];
+
+            const QJsonObject object = QJsonDocument::fromJson(event).object();
+            if (object.isEmpty()) {
+                ++invalid;
+                continue;
+            }
+            ++types[object.value(QLatin1String("event_type")).toString()];
+            const qint64 time = qint64(object.value(QLatin1String("time")).toDouble(-1));
+            if (time >= 0) {
+                oldest = oldest < 0 ? time : qMin(oldest, time);
+                newest = qMax(newest, time);
+            }
+        }
+    }
+
+    out() << "Queue: " << queue.size() << " bytes (" << queue.storedSize() << " stored)\n";
+    out() << "Readers:\n";
+    foreach (const QString &name, queue.readers()) {
+        out() << "  " << (name.isEmpty() ? QLatin1String("(default)") : name) << ": "
+              << queue.count(name) << " events\n";
+    }
+
+    out() << "Events: " << count << " (" << bytes << " bytes)";
+    if (invalid > 0)
+        out() << ", " << invalid << " not valid JSON";
+    out() << "\n";
+    if (count == 0)
+        return 0;
+
+    out() << "Event types:\n";
+    QMultiMap<qint64, QString> byCount;
+    for (QMap<QString, qint64>::const_iterator it = types.constBegin(); it != types.constEnd(); ++it)
+        byCount.insert(it.value(), it.key());
+    QMultiMap<qint64, QString>::const_iterator it = byCount.constEnd();
+    while (it != byCount.constBegin()) {
+        --it;
+        out() << "  " << it.value() << ": " << it.key() << "\n";
+    }
+
+    out() << "Sizes:\n";
+    for (int bucket = 0; bucket < sizes.count(); ++bucket) {
+        if (sizes.at(bucket) > 0)
+            out() << "  <= " << (Q_INT64_C(1) << bucket) << " bytes: " << sizes.at(bucket) << "\n";
+    }
+    out() << "  average: " << bytes / count << " bytes\n";
+
+    if (oldest >= 0) {
+        const qint64 now = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch();
+        out() << "Oldest: " << QDateTime::fromMSecsSinceEpoch(oldest).toUTC().toString(Qt::ISODate)
+              << " (" << (now - oldest) / 3600000.0 << " hours ago)\n";
+        out() << "Newest: " << QDateTime::fromMSecsSinceEpoch(newest).toUTC().toString(Qt::ISODate)
+              << " (" << (now - newest) / 3600000.0 << " hours ago)\n";
+    }
+    return 0;
+}
+
+int exportEvents(QAmplitudeEventQueue &queue, const QString &reader, const QString &fileName)
+{
+    QFile file(fileName);
+    const bool opened = fileName.isEmpty() || fileName == QLatin1String("-")
+                        ? file.open(stdout, QIODevice::WriteOnly)
+                        : file.open(QIODevice::WriteOnly);
+    if (!opened) {
+        err() << "Can't open " << fileName << ": " << file.errorString() << "\n";
+        return 1;
+    }
+
+    forever {
+        const QList<QByteArray> events = queue.read(reader, ChunkEvents, ChunkBytes);
+        if (events.isEmpty())
+            break;
+
+        foreach (const QByteArray &event, events) {
+            // Serialized events never contain raw line breaks
+            if (file.write(event) != event.size() || !file.putChar('\n')) {
+                err() << "Can't write " << fileName << ": " << file.errorString() << "\n";
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+// Sends events one batch at a time, in the same format as
+// QAmplitudeAnalytics, keeping to the given average rate
+class Replayer: public QObject
+{
+    Q_OBJECT
+
+public:
+    Replayer(QAmplitudeEventQueue *queue, const QString &reader, const QUrl &url,
+             const QString &apiKey, int batchEvents, qreal rate)
+        : m_queue(queue)
+        , m_reader(reader)
+        , m_url(url)
+        , m_apiKey(apiKey)
+        , m_batchEvents(batchEvents)
+        , m_rate(rate)
+        , m_sent(0)
+        , m_pending(0)
+    {
+        // Don't send much more than a second worth of events at once
+        if (m_rate > 0)
+            m_batchEvents = qBound(1, int(m_rate), m_batchEvents);
+        connect(&m_nam, SIGNAL(finished(QNetworkReply*)), this, SLOT(onFinished(QNetworkReply*)));
+    }
+
+public slots:
+    void start()
+    {
+        m_elapsed.start();
+        sendNext();
+    }
+
+private slots:
+    void sendNext()
+    {
+        const QList<QByteArray> events = m_queue->read(m_reader, m_batchEvents, ChunkBytes);
+        if (events.isEmpty()) {
+            out() << "Replayed " << m_sent << " events in " << m_elapsed.elapsed() << " ms\n";
+            out().flush();
+            QCoreApplication::exit(0);
+            return;
+        }
+
+        QByteArray data;
+        data.append("api_key=").append(QUrl::toPercentEncoding(m_apiKey));
+        data.append("&event=%5B");
+        for (int i = 0; i < events.count(); ++i) {
+            if (i > 0)
+                data.append("%2C");
+            data.append(events.at(i).toPercentEncoding());
+        }
+        data.append("%5D");
+
+        QNetworkRequest request(m_url);
+        request.setHeader(QNetworkRequest::ContentTypeHeader,
+                          QLatin1String("application/x-www-form-urlencoded;charset=UTF-8"));
+        m_pending = events.count();
+        m_nam.post(request, data);
+    }
+
+    void onFinished(QNetworkReply *reply)
+    {
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError) {
+            err() << "Request failed after " << m_sent << " events: "
+                  << reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() << " "
+                  << reply->errorString() << "\n" << reply->readAll() << "\n";
+            err().flush();
+            QCoreApplication::exit(1);
+            return;
+        }
+
+        m_sent += m_pending;
+        qint64 delay = 0;
+        if (m_rate > 0)
+            delay = qint64(m_sent * 1000 / m_rate) - m_elapsed.elapsed();
+        QTimer::singleShot(int(qMax(Q_INT64_C(0), delay)), this, SLOT(sendNext()));
+    }
+
+private:
+    QAmplitudeEventQueue *m_queue;
+    QString m_reader;
+    QUrl m_url;
+    QString m_apiKey;
+    int m_batchEvents;
+    qreal m_rate;
+    qint64 m_sent;
+    int m_pending;
+    QElapsedTimer m_elapsed;
+    QNetworkAccessManager m_nam;
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QLatin1String("amplitudequeue"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String("Inspects the event queue of QAmplitudeAnalytics."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QLatin1String("command"),
+                                 QLatin1String("stats, export or replay."));
+    parser.addPositionalArgument(QLatin1String("queue"),
+                                 QLatin1String("Queue directory, <settings file name>.queue."));
+    const QCommandLineOption readerOption(QLatin1String("reader"),
+            QLatin1String("Read events pending for this reader instead of the default one."),
+            QLatin1String("name"));
+    const QCommandLineOption outputOption(QStringList() << QLatin1String("o") << QLatin1String("output"),
+            QLatin1String("Export to this file instead of standard output."),
+            QLatin1String("file"));
+    const QCommandLineOption urlOption(QLatin1String("url"),
+            QLatin1String("Endpoint to replay events to."),
+            QLatin1String("url"), QLatin1String("https://api.amplitude.com/httpapi"));
+    const QCommandLineOption apiKeyOption(QLatin1String("api-key"),
+            QLatin1String("API key to replay events with."),
+            QLatin1String("key"));
+    const QCommandLineOption rateOption(QLatin1String("rate"),
+            QLatin1String("Replay at most this many events per second, 0 for no limit."),
+            QLatin1String("events"), QLatin1String("100"));
+    const QCommandLineOption batchOption(QLatin1String("batch"),
+            QLatin1String("Events per replay request."),
+            QLatin1String("events"), QLatin1String("100"));
+    parser.addOption(readerOption);
+    parser.addOption(outputOption);
+    parser.addOption(urlOption);
+    parser.addOption(apiKeyOption);
+    parser.addOption(rateOption);
+    parser.addOption(batchOption);
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.count() != 2)
+        parser.showHelp(1);
+    const QString command = arguments.at(0);
+    if (!QDir(arguments.at(1)).exists()) {
+        err() << arguments.at(1) << " doesn't exist\n";
+        return 1;
+    }
+
+    QAmplitudeEventQueue queue(arguments.at(1), QAmplitudeEventQueue::ReadOnly);
+    const QString reader = parser.value(readerOption);
+    if (!queue.readers().contains(reader)) {
+        err() << "No reader " << reader << "\n";
+        return 1;
+    }
+
+    if (command == QLatin1String("stats"))
+        return printStats(queue, reader);
+    if (command == QLatin1String("export"))
+        return exportEvents(queue, reader, parser.value(outputOption));
+    if (command == QLatin1String("replay")) {
+        if (!parser.isSet(apiKeyOption)) {
+            err() << "Replaying requires --api-key\n";
+            return 1;
+        }
+        Replayer replayer(&queue, reader, QUrl(parser.value(urlOption)),
+                          parser.value(apiKeyOption),
+                          qMax(1, parser.value(batchOption).toInt()),
+                          qMax(qreal(0), qreal(parser.value(rateOption).toDouble())));
+        QTimer::singleShot(0, &replayer, SLOT(start()));
+        return app.exec();
+    }
+
+    parser.showHelp(1);
+    return 1;
+}
+
+#include "main.moc"